@@ -106,6 +106,9 @@ allocproc(void)
 
 found:
   p->pid = allocpid();
+  p->alarm_interval = 0;
+  p->alarm_handler = 0;
+  p->alarm_ticks = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -103,4 +103,7 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int alarm_interval;          // Ticks between alarm upcalls, or 0
+  uint64 alarm_handler;        // User address of the alarm handler
+  int alarm_ticks;             // Ticks since the last alarm upcall
 };
@@ -95,3 +95,41 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// call handler(frame) every ticks clock ticks of CPU time,
+// or stop if ticks is 0. see alarmupcall() in trap.c.
+uint64
+sys_sigalarm(void)
+{
+  int ticks;
+  uint64 handler;
+  struct proc *p = myproc();
+
+  if(argint(0, &ticks) < 0 || argaddr(1, &handler) < 0)
+    return -1;
+  if(ticks < 0)
+    return -1;
+  p->alarm_interval = ticks;
+  p->alarm_handler = handler;
+  p->alarm_ticks = 0;
+  return 0;
+}
+
+// return from an alarm handler: restore the user
+// registers that alarmupcall() pushed at frame.
+uint64
+sys_sigreturn(void)
+{
+  uint64 frame;
+  struct trapframe tf;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &frame) < 0)
+    return -1;
+  if(copyin(p->pagetable, (char *)&tf, frame, sizeof(tf)) < 0)
+    return -1;
+  // the kernel_* fields are reset by usertrapret().
+  *p->trapframe = tf;
+  // syscall() stores the return value in a0.
+  return tf.a0;
+}
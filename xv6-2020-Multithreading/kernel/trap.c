@@ -15,6 +15,7 @@ extern char trampoline[], uservec[], userret[];
 void kernelvec();
 
 extern int devintr();
+static void alarmupcall(struct proc *);
 
 void
 trapinit(void)
@@ -73,6 +74,13 @@ usertrap(void)
     p->killed = 1;
   }
 
+  // is the process's alarm due?
+  if(which_dev == 2 && p->alarm_interval != 0 &&
+     ++p->alarm_ticks >= p->alarm_interval){
+    p->alarm_ticks = 0;
+    alarmupcall(p);
+  }
+
   if(p->killed)
     exit(-1);
 
@@ -83,6 +91,38 @@ usertrap(void)
   usertrapret();
 }
 
+// Make p return to user space in its alarm handler. The
+// interrupted user registers are pushed onto the user stack,
+// and the handler gets their address as its argument; it
+// resumes the interrupted code with sigreturn(frame). Since
+// each upcall has its own frame, the handler may switch to
+// another user-level thread before returning, and alarms
+// keep coming meanwhile.
+static void
+alarmupcall(struct proc *p)
+{
+  uint64 sp;
+  struct trapframe tf;
+
+  // don't show user space the kernel's addresses;
+  // usertrapret() sets the kernel_* fields again.
+  tf = *p->trapframe;
+  tf.kernel_satp = 0;
+  tf.kernel_sp = 0;
+  tf.kernel_trap = 0;
+  tf.kernel_hartid = 0;
+
+  sp = (p->trapframe->sp - sizeof(struct trapframe)) & ~0xfL;
+  if(copyout(p->pagetable, sp, (char *)&tf, sizeof(tf)) < 0){
+    printf("alarmupcall: bad user stack pid=%d\n", p->pid);
+    p->killed = 1;
+    return;
+  }
+  p->trapframe->sp = sp;
+  p->trapframe->a0 = sp;
+  p->trapframe->epc = p->alarm_handler;
+}
+
 //
 // return to user space
 //
@@ -0,0 +1,311 @@
+// 抢占式用户级线程运行时
+//
+// 与 uthread.c 不同：
+// - 线程数不受限制：线程控制块放在各自栈的顶部，栈用 sbrk()
+//   分配，线程结束后放入空闲链表重复使用，不调用 malloc()。
+// - 每个工作者 (worker) 有自己的就绪双端队列，入队、出队都是 O(1)，
+//   不再线性扫描线程池。
+// - 抢占：gthread_init(ticks) 用 sigalarm() 每隔 ticks 个时钟周期
+//   调用 preempt()，它把当前线程放回队列并切换到下一个线程。
+//   被打断的寄存器由内核压在线程自己的栈上，线程重新运行时
+//   preempt() 用 sigreturn() 恢复它们。
+//
+// 工作者对应一个内核执行上下文。本内核没有内核线程，每个进程
+// 只有一个执行上下文，因此 NWORKER 为 1，N 个用户线程都映射到
+// 这一个上下文上。在有 clone() 的内核上，每个工作者可运行在自己的
+// 内核线程上，就绪队列为空时用 steal() 从其他工作者的队列尾部
+// 窃取线程；那时队列操作需要加锁。
+//
+// 注意：malloc() 不可重入，多个线程同时使用它时需要调用者自己保护。
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/gthread.h"
+
+#define NWORKER       1
+#define STACK_SIZE    8192                  // 每个线程的栈大小（含线程控制块）
+#define STACK_MAGIC   0x6774687265616421UL  // 栈底哨兵值，被改写说明栈溢出
+
+// 阻止编译器把内存访问移过运行时的临界区边界。
+// 抢占只发生在同一个执行上下文中，不需要硬件内存屏障。
+#define barrier() asm volatile("" ::: "memory")
+
+// 线程状态
+#define GT_RUNNABLE  1  // 在就绪队列中
+#define GT_RUNNING   2  // 正在运行
+#define GT_DONE      3  // 已结束，等待回收栈
+
+// 与 uthread_switch.S 中 thread_switch 使用的布局一致
+struct thread_context {
+  uint64 ra;
+  uint64 sp;
+  uint64 s[12];     // s0 - s11
+};
+
+struct gthread {
+  struct thread_context context;
+  int state;
+  void (*fn)(void *);
+  void *arg;
+  char *stack;                   // 栈的最低地址，主线程为 0
+  struct gthread *prev, *next;   // 就绪队列中的前后线程
+};
+
+struct worker {
+  struct gthread *head, *tail;   // 就绪双端队列：从头部取，向尾部放
+  struct gthread *current;       // 正在运行的线程
+  struct gthread *dead;          // 刚结束、栈还未回收的线程
+  volatile int busy;             // 正在执行运行时代码，不能抢占
+  volatile int pending;          // busy 期间到期的抢占
+};
+
+static struct worker workers[NWORKER];
+static struct gthread mainthread;   // main() 所在的线程，使用进程原有的栈
+static char *freestacks;            // 空闲栈链表，链接指针存放在栈底
+static int nlive;                   // 除主线程外尚未结束的线程数
+
+extern void thread_switch(uint64, uint64);
+
+static struct worker*
+myworker(void)
+{
+  return &workers[0];
+}
+
+static void
+pushtail(struct worker *w, struct gthread *t)
+{
+  t->state = GT_RUNNABLE;
+  t->next = 0;
+  t->prev = w->tail;
+  if(w->tail)
+    w->tail->next = t;
+  else
+    w->head = t;
+  w->tail = t;
+}
+
+static struct gthread*
+pophead(struct worker *w)
+{
+  struct gthread *t = w->head;
+
+  if(t){
+    w->head = t->next;
+    if(w->head)
+      w->head->prev = 0;
+    else
+      w->tail = 0;
+  }
+  return t;
+}
+
+static struct gthread*
+poptail(struct worker *w)
+{
+  struct gthread *t = w->tail;
+
+  if(t){
+    w->tail = t->prev;
+    if(w->tail)
+      w->tail->next = 0;
+    else
+      w->head = 0;
+  }
+  return t;
+}
+
+// 本工作者没有就绪线程时，从其他工作者的队列尾部窃取一个。
+static struct gthread*
+steal(struct worker *w)
+{
+  struct worker *v;
+  struct gthread *t;
+
+  for(v = workers; v < &workers[NWORKER]; v++){
+    if(v != w && (t = poptail(v)) != 0)
+      return t;
+  }
+  return 0;
+}
+
+static struct gthread*
+picknext(struct worker *w)
+{
+  struct gthread *t;
+
+  if((t = pophead(w)) == 0)
+    t = steal(w);
+  return t;
+}
+
+static char*
+stackalloc(void)
+{
+  char *s;
+
+  if(freestacks){
+    s = freestacks;
+    freestacks = *(char **)s;
+  } else if((s = sbrk(STACK_SIZE)) == (char *)-1){
+    return 0;
+  }
+  *(uint64 *)s = STACK_MAGIC;
+  return s;
+}
+
+static void
+stackfree(char *s)
+{
+  *(char **)s = freestacks;
+  freestacks = s;
+}
+
+// 离开运行时代码：回收刚结束的线程的栈，
+// 并处理 busy 期间到期的抢占。
+static void
+leave(struct worker *w)
+{
+  if(w->dead){
+    stackfree(w->dead->stack);
+    w->dead = 0;
+  }
+  barrier();
+  w->busy = 0;
+  barrier();
+  if(w->pending){
+    w->pending = 0;
+    gthread_yield();
+  }
+}
+
+// 从当前线程切换到 next。调用者已设置 w->busy。
+// 当前线程再次被调度时返回。
+static void
+switchto(struct worker *w, struct gthread *next)
+{
+  struct gthread *prev = w->current;
+
+  if(prev->stack && *(uint64 *)prev->stack != STACK_MAGIC){
+    fprintf(2, "gthread: stack overflow\n");
+    exit(1);
+  }
+  next->state = GT_RUNNING;
+  w->current = next;
+  w->pending = 0;
+  thread_switch((uint64)&prev->context, (uint64)&next->context);
+}
+
+// 新线程从这里开始运行
+static void
+gthread_start(void)
+{
+  struct worker *w = myworker();
+  struct gthread *t = w->current;
+
+  leave(w);
+  t->fn(t->arg);
+  gthread_exit();
+}
+
+// 时钟到期：抢占当前线程。frame 是内核压入的被打断的寄存器。
+static void
+preempt(void *frame)
+{
+  struct worker *w = myworker();
+
+  if(w->busy)
+    w->pending = 1;
+  else
+    gthread_yield();
+  sigreturn(frame);
+}
+
+// 初始化运行时，main() 成为第一个线程。
+// ticks > 0 时每隔 ticks 个时钟周期抢占一次，为 0 时只在
+// 线程调用 gthread_yield() 时切换。
+void
+gthread_init(int ticks)
+{
+  struct worker *w = myworker();
+
+  mainthread.state = GT_RUNNING;
+  w->current = &mainthread;
+  if(ticks > 0)
+    sigalarm(ticks, preempt);
+}
+
+// 创建运行 fn(arg) 的线程，放到当前工作者的就绪队列尾部。
+// 内存不足时返回 0。
+struct gthread*
+gthread_create(void (*fn)(void *), void *arg)
+{
+  struct worker *w = myworker();
+  struct gthread *t;
+  char *stack;
+
+  w->busy = 1;
+  barrier();
+  if((stack = stackalloc()) == 0){
+    leave(w);
+    return 0;
+  }
+  // 线程控制块放在栈顶，栈从它的下方开始向下增长。
+  t = (struct gthread *)(stack + STACK_SIZE - sizeof(struct gthread));
+  memset(t, 0, sizeof(*t));
+  t->fn = fn;
+  t->arg = arg;
+  t->stack = stack;
+  t->context.ra = (uint64)gthread_start;
+  t->context.sp = (uint64)t & ~0xfUL;
+  nlive++;
+  pushtail(w, t);
+  leave(w);
+  return t;
+}
+
+// 当前线程让出 CPU，排到就绪队列尾部。
+void
+gthread_yield(void)
+{
+  struct worker *w = myworker();
+  struct gthread *next;
+
+  w->busy = 1;
+  barrier();
+  if((next = picknext(w)) != 0){
+    pushtail(w, w->current);
+    switchto(w, next);
+  }
+  leave(w);
+}
+
+// 结束当前线程。它的栈由下一个运行的线程回收。
+void
+gthread_exit(void)
+{
+  struct worker *w = myworker();
+  struct gthread *t = w->current, *next;
+
+  if(t == &mainthread)
+    exit(0);
+  w->busy = 1;
+  barrier();
+  t->state = GT_DONE;
+  nlive--;
+  if((next = picknext(w)) == 0)
+    exit(0);
+  w->dead = t;
+  switchto(w, next);
+  fprintf(2, "gthread: exited thread ran again\n");
+  exit(1);
+}
+
+// 主线程等待其他线程全部结束。
+void
+gthread_waitall(void)
+{
+  while(nlive > 0)
+    gthread_yield();
+}
@@ -0,0 +1,9 @@
+// 抢占式用户级线程运行时，实现见 gthread.c。
+
+struct gthread;
+
+void gthread_init(int ticks);
+struct gthread *gthread_create(void (*fn)(void *), void *arg);
+void gthread_yield(void);
+void gthread_exit(void) __attribute__((noreturn));
+void gthread_waitall(void);
@@ -0,0 +1,83 @@
+// gthread 运行时的测试与基准
+//
+// usage: gthreadbench [nthreads [nyield]]
+//
+// 第一部分创建 nthreads 个线程，每个线程调用 gthread_yield()
+// nyield 次，报告切换次数和所用时钟周期数。
+// 第二部分创建几个从不让出 CPU 的线程，检查它们都能靠
+// sigalarm() 抢占得到运行。
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/gthread.h"
+
+#define NSPIN 4
+
+static int nyield = 50;
+static int nswitch;
+static volatile int stop;
+static volatile int counts[NSPIN];
+
+static void
+yielder(void *arg)
+{
+  int i;
+
+  for(i = 0; i < nyield; i++){
+    nswitch++;
+    gthread_yield();
+  }
+}
+
+static void
+spinner(void *arg)
+{
+  volatile int *c = arg;
+
+  while(!stop)
+    (*c)++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nthreads = 2000;
+  int i, t0, t1;
+
+  if(argc > 1)
+    nthreads = atoi(argv[1]);
+  if(argc > 2)
+    nyield = atoi(argv[2]);
+
+  gthread_init(1);
+
+  t0 = uptime();
+  for(i = 0; i < nthreads; i++){
+    if(gthread_create(yielder, 0) == 0){
+      fprintf(2, "gthreadbench: out of memory after %d threads\n", i);
+      break;
+    }
+  }
+  gthread_waitall();
+  t1 = uptime();
+  printf("gthreadbench: %d threads, %d yields, %d ticks\n",
+         i, nswitch, t1 - t0);
+
+  // 主线程也不让出 CPU，只能被抢占。
+  for(i = 0; i < NSPIN; i++)
+    gthread_create(spinner, (void *)&counts[i]);
+  t0 = uptime();
+  while(uptime() - t0 < 10)
+    ;
+  stop = 1;
+  gthread_waitall();
+  for(i = 0; i < NSPIN; i++){
+    if(counts[i] == 0){
+      printf("gthreadbench: spinner %d never ran\n", i);
+      exit(1);
+    }
+  }
+  printf("gthreadbench: preemption ok\n");
+  exit(0);
+}
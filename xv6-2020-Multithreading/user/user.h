@@ -23,6 +23,8 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int sigalarm(int ticks, void (*handler)(void*));
+int sigreturn(void*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -1,13 +1,27 @@
 // Buffer cache.
 //
 // The buffer cache uses a hash table with fine-grained locking to reduce contention.
-// Each hash bucket has its own lock, allowing concurrent access to different blocks.
+// The buckets are spread over a fixed set of locks, allowing concurrent access to
+// different blocks. The table grows with the cache by linear hashing: one bucket
+// is split at a time, so there is never a stop-the-world rehash.
+// A lookup that finds its block takes no lock at all: it walks the hash chain
+// inside an rcu read-side section and takes a reference with compare-and-swap.
+// Beyond a static pool of NBUF buffers, the cache grows a page of buffers at a
+// time from kalloc, up to 1/BCACHEFRAC of memory, and gives unused pages back
+// when kalloc runs out (see bshrink); those are freed after an rcu grace
+// period, since a lock-free lookup may still be walking through them.
+// Replacement follows 2Q, so that one long sequential read cannot flush
+// blocks that are used again and again, like inode and bitmap blocks (see
+// bvictim). Each cpu keeps its own replacement queues.
 // Cached copies of disk block contents are stored in memory to reduce disk reads
 // and provide synchronization for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * To get buffers for several consecutive blocks, call bread_range.
+// * To start reading blocks that will be needed soon, call bread_async.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwrite_range for several buffers at once.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -16,60 +30,515 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "percpu.h"
+#include "rcu.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
 
-// 哈希表优化配置
-#define HASH_BUCKET_COUNT 13        // 使用质数减少哈希冲突
+// 哈希表配置
+// 桶的数目从HASH_LOCK_COUNT开始，随缓存扩容逐个分裂，保持平均链长不超过1
+// 桶号为n时使用的锁是bucket_locks[hash % HASH_LOCK_COUNT]：
+// 分裂桶s得到的新桶是s + 2^k，两者总是共用同一把锁
+#define HASH_LOCK_COUNT 128         // 必须是2的幂
+#define HASH_DIR_SIZE (PGSIZE / sizeof(struct buf*))  // 每页目录容纳的桶数
+#define HASH_DIR_COUNT 64           // 最多HASH_DIR_COUNT页目录
 
-extern uint ticks;  // 系统时钟计数，用于LRU时间戳
+extern char end[];  // 内核之后的第一个地址，用于计算可用内存
+
+// 驱逐者正在改写缓冲区的dev/blockno时置于refcnt中，
+// 此时无锁查找不得获取该缓冲区
+// 空闲链表中的缓冲区也一直带有此标记
+#define BUF_BUSY 0x80000000
+
+// 动态分配的缓冲区页：一页物理内存容纳BUF_PER_PAGE个缓冲区
+#define BUF_PER_PAGE 3
+
+// bread_async一次最多持有的待读缓冲区数
+#define ASYNC_BATCH 16
+struct buf_page {
+  struct rcuhead rcu;                 // 宽限期结束后释放本页
+  struct buf_page *next;              // 所有动态页组成的链表
+  struct buf bufs[BUF_PER_PAGE];
+};
+
+// 2Q替换策略
+// 第一次读入的块进入A1队列（先进先出），从A1被驱逐时只在幽灵表中留下块号；
+// 被驱逐后不久又被读入的块说明会被反复使用，进入Am队列（近似LRU）
+// A1超过队列的A1_PERCENT时从A1驱逐，否则从Am驱逐，
+// 所以顺序扫描只会冲刷A1，而不会冲刷Am中的元数据块
+#define BQ_NONE 0           // 不在任何队列中（空闲或正被驱逐）
+#define BQ_A1   1
+#define BQ_AM   2
+#define A1_PERCENT 25
+
+// 队列链表，表头是最近加入的缓冲区，驱逐从表尾开始
+struct blist {
+  struct buf *head;
+  struct buf *tail;
+  int n;
+};
+
+// 每个CPU的替换队列：未命中时读入的缓冲区加入当前CPU的队列，
+// 驱逐时先在当前CPU的队列中选择，不必争用全局锁
+struct bqueue {
+  struct spinlock lock;
+  struct blist a1;
+  struct blist am;
+  int id;                             // 所属CPU的编号
+};
+static DEFINE_PERCPU(struct bqueue, bqueues);
+
+// 命中与未命中次数，供statslock输出
+struct bstat {
+  int hits;
+  int misses;
+};
+static DEFINE_PERCPU(struct bstat, bstats);
+
+// 幽灵表：最近从A1驱逐的块号，按先进先出循环覆盖
+// 用哈希链查找，链中以下标相连，-1表示链尾
+#define NGHOST 4096
+#define GHOST_HASH 1021
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint blockno;
+    short next;                       // 同一哈希链中的下一项
+    char valid;
+  } ent[NGHOST];
+  short head[GHOST_HASH];
+  int pos;                            // 下一个要覆盖的位置
+} ghosts;
 
 // 缓冲区缓存管理结构
 struct {
-  struct spinlock global_lock;                    // 全局锁，用于保护整体状态
-  struct buf buffer_pool[NBUF];                   // 缓冲区池
-  int allocated_buffer_count;                     // 已分配的缓冲区数量
-  
-  // 哈希表结构：每个桶维护一个链表和独立的锁
-  struct buf hash_buckets[HASH_BUCKET_COUNT];     // 哈希桶头节点
-  struct spinlock bucket_locks[HASH_BUCKET_COUNT]; // 每个桶的独立锁
-  struct spinlock eviction_lock;                  // 驱逐操作的序列化锁
+  struct spinlock global_lock;                    // 全局锁，保护空闲链表和缓冲区计数
+  struct buf buffer_pool[NBUF];                   // 静态缓冲区池，即缓存的最小容量
+  struct buf *free_list;                          // 尚未加入哈希表的缓冲区
+  int buffer_count;                               // 现有缓冲区总数
+  int max_buffer_count;                           // 缓冲区数量上限，由内存大小决定
+  struct buf_page *pages;                         // 动态分配的页，受grow_lock保护
+
+  // 哈希表结构：桶头放在按需分配的目录页中，directory[i]一旦设置就不再改变
+  // geometry的低32位是桶数n，高32位是不超过n的最大2的幂
+  struct buf **directory[HASH_DIR_COUNT];
+  uint64 geometry;
+  uint max_buckets;                               // 桶数上限
+  struct spinlock bucket_locks[HASH_LOCK_COUNT];  // 哈希桶的锁
+  struct spinlock grow_lock;                      // 扩容和收缩操作的序列化锁
 } buffer_cache;
 
+static int bshrink(int);
+static int bgrow(void);
+static void bdiscard(struct buf*);
+
 // 初始化缓冲区缓存系统
 // 设置哈希表、锁和缓冲区池
 void
 binit(void)
 {
   struct buf *buffer_ptr;
-  int bucket_index;
+  struct bqueue *queue;
+  int bucket_index, i;
+
+  if(sizeof(struct buf_page) > PGSIZE)
+    panic("binit: buf_page");
+
+  // 第一页目录，起初有HASH_LOCK_COUNT个桶
+  if((buffer_cache.directory[0] = kalloc()) == 0)
+    panic("binit: directory");
+  memset(buffer_cache.directory[0], 0, PGSIZE);
+  buffer_cache.geometry = ((uint64)HASH_LOCK_COUNT << 32) | HASH_LOCK_COUNT;
+
+  buffer_cache.free_list = 0;
+  buffer_cache.buffer_count = NBUF;
+  buffer_cache.max_buffer_count = NBUF +
+    ((PHYSTOP - (uint64)end) / BCACHEFRAC / PGSIZE) * BUF_PER_PAGE;
+  buffer_cache.pages = 0;
+  for(buffer_cache.max_buckets = HASH_LOCK_COUNT;
+      buffer_cache.max_buckets < buffer_cache.max_buffer_count &&
+      buffer_cache.max_buckets < HASH_DIR_COUNT * HASH_DIR_SIZE;
+      buffer_cache.max_buckets *= 2)
+    ;
 
-  buffer_cache.allocated_buffer_count = 0;
-  
   // 初始化各种锁
   initlock(&buffer_cache.global_lock, "bcache");
-  initlock(&buffer_cache.eviction_lock, "bcache.eviction");
-  
+  initlock(&buffer_cache.grow_lock, "bcache.grow");
+
   // 初始化每个哈希桶的锁
-  for(bucket_index = 0; bucket_index < HASH_BUCKET_COUNT; bucket_index++) {
+  for(bucket_index = 0; bucket_index < HASH_LOCK_COUNT; bucket_index++) {
     initlock(&buffer_cache.bucket_locks[bucket_index], "bcache.bucket");
   }
 
-  // 初始化缓冲区池中每个缓冲区的睡眠锁
+  // 初始化每个CPU的替换队列
+  for(i = 0; i < NCPU; i++) {
+    queue = per_cpu_ptr(&bqueues, i);
+    initlock(&queue->lock, "bcache.queue");
+    queue->id = i;
+  }
+
+  // 初始化幽灵表
+  initlock(&ghosts.lock, "bcache.ghost");
+  for(i = 0; i < GHOST_HASH; i++)
+    ghosts.head[i] = -1;
+
+  // 初始化缓冲区池中每个缓冲区的睡眠锁，并放入空闲链表
   for(buffer_ptr = buffer_cache.buffer_pool; buffer_ptr < buffer_cache.buffer_pool + NBUF; buffer_ptr++){
     initsleeplock(&buffer_ptr->lock, "buffer");
+    buffer_ptr->refcnt = BUF_BUSY;
+    buffer_ptr->free = 1;
+    buffer_ptr->next = buffer_cache.free_list;
+    buffer_cache.free_list = buffer_ptr;
   }
+
+  // 内存不足时由kalloc调用，归还未使用的缓冲区页
+  registershrinker(bshrink);
+}
+
+// 计算设备号和块号的哈希值
+// 乘法哈希，再把高位折叠到低位，因为桶号取的是低位
+static uint
+bhash(uint dev, uint blockno)
+{
+  uint h = (blockno ^ (dev << 24)) * 0x9E3779B1;
+
+  return h ^ (h >> 16);
 }
 
-// 计算设备号和块号对应的哈希桶索引
+// 按线性哈希计算哈希值所在的桶号：
+// 先取不超过2n的低位，若该桶尚未分裂出来，再取不超过n的低位
 static uint
-calculate_hash_index(uint blockno)
+bindex(uint hash, uint64 geometry)
+{
+  uint n = geometry, half = geometry >> 32;
+  uint index = hash & (2 * half - 1);
+
+  if(index >= n)
+    index = hash & (half - 1);
+  return index;
+}
+
+// 哈希值所在的桶的锁，不随分裂改变
+static struct spinlock*
+bucket_lock(uint hash)
+{
+  return &buffer_cache.bucket_locks[hash & (HASH_LOCK_COUNT - 1)];
+}
+
+// 桶号对应的桶头
+static struct buf**
+bucket_slot(uint index)
+{
+  return &buffer_cache.directory[index / HASH_DIR_SIZE][index % HASH_DIR_SIZE];
+}
+
+// 哈希值所在的桶的桶头
+// 调用者必须持有bucket_lock(hash)，这样该桶不会同时分裂
+static struct buf**
+bucket_head(uint hash)
+{
+  return bucket_slot(bindex(hash, buffer_cache.geometry));
+}
+
+// 从哈希桶中取下缓冲区
+// 正在遍历该缓冲区的无锁查找仍可通过它的next继续前进
+static void
+bunlink(struct buf *buffer_ptr)
+{
+  uint hash = bhash(buffer_ptr->dev, buffer_ptr->blockno);
+  struct buf **pp;
+
+  acquire(bucket_lock(hash));
+  for(pp = bucket_head(hash); *pp != buffer_ptr; pp = &(*pp)->next)
+    ;
+  __atomic_store_n(pp, buffer_ptr->next, __ATOMIC_RELEASE);
+  release(bucket_lock(hash));
+}
+
+// 把块号记入幽灵表，覆盖最早的一项
+// 调用者可以持有队列的锁
+static void
+ghostadd(uint dev, uint blockno)
+{
+  short *pp;
+  int i;
+
+  acquire(&ghosts.lock);
+  i = ghosts.pos;
+  if(ghosts.ent[i].valid) {
+    for(pp = &ghosts.head[ghosts.ent[i].blockno % GHOST_HASH]; *pp != i; pp = &ghosts.ent[*pp].next)
+      ;
+    *pp = ghosts.ent[i].next;
+  }
+  ghosts.ent[i].dev = dev;
+  ghosts.ent[i].blockno = blockno;
+  ghosts.ent[i].valid = 1;
+  ghosts.ent[i].next = ghosts.head[blockno % GHOST_HASH];
+  ghosts.head[blockno % GHOST_HASH] = i;
+  ghosts.pos = (i + 1) % NGHOST;
+  release(&ghosts.lock);
+}
+
+// 块是否最近从A1被驱逐过？是则从幽灵表中删除并返回1
+static int
+ghosttake(uint dev, uint blockno)
+{
+  short *pp;
+  int i;
+
+  acquire(&ghosts.lock);
+  for(pp = &ghosts.head[blockno % GHOST_HASH]; (i = *pp) >= 0; pp = &ghosts.ent[i].next) {
+    if(ghosts.ent[i].dev == dev && ghosts.ent[i].blockno == blockno) {
+      *pp = ghosts.ent[i].next;
+      ghosts.ent[i].valid = 0;
+      release(&ghosts.lock);
+      return 1;
+    }
+  }
+  release(&ghosts.lock);
+  return 0;
+}
+
+// 把缓冲区加到队列链表的头部
+static void
+blist_push(struct blist *list, struct buf *buffer_ptr)
+{
+  buffer_ptr->qprev = 0;
+  buffer_ptr->qnext = list->head;
+  if(list->head)
+    list->head->qprev = buffer_ptr;
+  else
+    list->tail = buffer_ptr;
+  list->head = buffer_ptr;
+  list->n++;
+}
+
+// 把缓冲区从队列链表中取下
+static void
+blist_remove(struct blist *list, struct buf *buffer_ptr)
+{
+  if(buffer_ptr->qprev)
+    buffer_ptr->qprev->qnext = buffer_ptr->qnext;
+  else
+    list->head = buffer_ptr->qnext;
+  if(buffer_ptr->qnext)
+    buffer_ptr->qnext->qprev = buffer_ptr->qprev;
+  else
+    list->tail = buffer_ptr->qprev;
+  list->n--;
+}
+
+// 把新读入的缓冲区加入当前CPU的替换队列
+// 最近从A1被驱逐过的块直接进入Am
+static void
+bqueue_add(struct buf *buffer_ptr, int hot)
+{
+  // 即使随后被调度到其他CPU，队列也由自己的锁保护
+  struct bqueue *queue = this_cpu_ptr(&bqueues);
+
+  acquire(&queue->lock);
+  buffer_ptr->queue = queue->id;
+  buffer_ptr->ref = 0;
+  if(hot) {
+    buffer_ptr->list = BQ_AM;
+    blist_push(&queue->am, buffer_ptr);
+  } else {
+    buffer_ptr->list = BQ_A1;
+    blist_push(&queue->a1, buffer_ptr);
+  }
+  release(&queue->lock);
+}
+
+// 把缓冲区从所在的替换队列中取下
+// 调用者必须已将refcnt置为BUF_BUSY，这样缓冲区不会同时换到别的队列
+static void
+bqueue_remove(struct buf *buffer_ptr)
+{
+  struct bqueue *queue = per_cpu_ptr(&bqueues, buffer_ptr->queue);
+
+  acquire(&queue->lock);
+  blist_remove(buffer_ptr->list == BQ_AM ? &queue->am : &queue->a1, buffer_ptr);
+  buffer_ptr->list = BQ_NONE;
+  release(&queue->lock);
+}
+
+// 在队列的一个链表中选择要驱逐的缓冲区，将其refcnt置为BUF_BUSY并取下
+// 调用者必须持有队列的锁
+// 正被使用的缓冲区和Am中最近命中过的缓冲区移回表头（第二次机会），
+// 所以每个缓冲区最多被跳过两次，找不到时返回0
+static struct buf*
+bvictim_list(struct bqueue *queue, struct blist *list)
+{
+  struct buf *buffer_ptr;
+  int steps = 2 * list->n;
+
+  while(steps-- > 0) {
+    buffer_ptr = list->tail;
+    if((list == &queue->am && buffer_ptr->ref) ||
+       !__sync_bool_compare_and_swap(&buffer_ptr->refcnt, 0, BUF_BUSY)) {
+      buffer_ptr->ref = 0;
+      blist_remove(list, buffer_ptr);
+      blist_push(list, buffer_ptr);
+      continue;
+    }
+    // 已提交但未写回原位置的块由日志固定，引用计数不会为0
+    if(buffer_ptr->dirty)
+      panic("bvictim: dirty");
+    blist_remove(list, buffer_ptr);
+    buffer_ptr->list = BQ_NONE;
+    if(list == &queue->a1)
+      ghostadd(buffer_ptr->dev, buffer_ptr->blockno);
+    return buffer_ptr;
+  }
+  return 0;
+}
+
+// 在队列中选择一个要驱逐的缓冲区
+// 调用者必须持有队列的锁
+// A1超过A1_PERCENT时先从A1选择，否则先从Am选择；
+// 其中的缓冲区都在使用中时（例如都被日志固定）再从另一个链表选择
+static struct buf*
+bvictim(struct bqueue *queue)
+{
+  struct blist *first, *second;
+  struct buf *buffer_ptr;
+
+  if(queue->a1.n > 0 &&
+     (queue->am.n == 0 || queue->a1.n * 100 > (queue->a1.n + queue->am.n) * A1_PERCENT)) {
+    first = &queue->a1;
+    second = &queue->am;
+  } else {
+    first = &queue->am;
+    second = &queue->a1;
+  }
+  if((buffer_ptr = bvictim_list(queue, first)) == 0)
+    buffer_ptr = bvictim_list(queue, second);
+  return buffer_ptr;
+}
+
+// 驱逐一个未被使用的缓冲区：先在当前CPU的队列中选择，再依次查看其他CPU的队列
+// 返回的缓冲区已从哈希表中取下，refcnt为BUF_BUSY；没有可驱逐的缓冲区时返回0
+static struct buf*
+bevict(void)
+{
+  struct bqueue *queue;
+  struct buf *buffer_ptr = 0;
+  int i, id;
+
+  id = this_cpu_ptr(&bqueues)->id;
+  for(i = 0; i < NCPU && buffer_ptr == 0; i++) {
+    queue = per_cpu_ptr(&bqueues, (id + i) % NCPU);
+    acquire(&queue->lock);
+    buffer_ptr = bvictim(queue);
+    release(&queue->lock);
+  }
+  if(buffer_ptr == 0)
+    return 0;
+
+  // 从原来的哈希桶中取下
+  bunlink(buffer_ptr);
+  return buffer_ptr;
+}
+
+// 无锁地为缓冲区增加一个引用
+// 驱逐者正在改写该缓冲区时失败，返回0
+static int
+bhold(struct buf *buffer_ptr)
+{
+  uint refcnt;
+
+  for(;;) {
+    refcnt = __atomic_load_n(&buffer_ptr->refcnt, __ATOMIC_RELAXED);
+    if(refcnt & BUF_BUSY)
+      return 0;
+    if(__sync_bool_compare_and_swap(&buffer_ptr->refcnt, refcnt, refcnt + 1))
+      return 1;
+  }
+}
+
+// 释放一个引用
+static void
+bput(struct buf *buffer_ptr)
+{
+  __sync_sub_and_fetch(&buffer_ptr->refcnt, 1);
+}
+
+// 记录一次命中
+// A1中的命中不改变任何状态；Am中的命中只置位ref，不必获取队列的锁
+static void
+bhit(struct buf *buffer_ptr)
+{
+  if(buffer_ptr->list == BQ_AM && !buffer_ptr->ref)
+    buffer_ptr->ref = 1;
+  this_cpu_inc(&bstats.hits);
+}
+
+// 不加锁地在哈希桶中查找指定的块
+// 缓冲区可能被驱逐者改作他用，所以获得引用后要再次检查它是否仍是要找的块；
+// 被收缩的缓冲区页要等rcu宽限期结束才释放，所以读侧临界区内可以放心遍历
+// 桶分裂时缓冲区可能被移到新桶，查找因此可能错过要找的块，但不会出错
+// 找到时返回已增加引用的缓冲区，否则返回0
+static struct buf*
+blookup(uint dev, uint blockno, uint hash)
 {
-  return blockno % HASH_BUCKET_COUNT;
+  struct buf *buffer_ptr;
+  uint index = bindex(hash, __atomic_load_n(&buffer_cache.geometry, __ATOMIC_ACQUIRE));
+
+  rcu_read_lock();
+  for(buffer_ptr = __atomic_load_n(bucket_slot(index), __ATOMIC_ACQUIRE);
+      buffer_ptr;
+      buffer_ptr = __atomic_load_n(&buffer_ptr->next, __ATOMIC_ACQUIRE)) {
+    if(buffer_ptr->dev == dev && buffer_ptr->blockno == blockno)
+      break;
+  }
+  if(buffer_ptr && bhold(buffer_ptr)) {
+    if(buffer_ptr->dev == dev && buffer_ptr->blockno == blockno) {
+      rcu_read_unlock();
+      return buffer_ptr;
+    }
+    // 获得引用之前已被驱逐
+    bput(buffer_ptr);
+  }
+  rcu_read_unlock();
+  return 0;
+}
+
+// 持有哈希桶的锁查找指定的块，找到时增加引用并返回
+// 正被驱逐的同名缓冲区即将从桶中取下，跳过它
+static struct buf*
+bfind(uint hash, uint dev, uint blockno)
+{
+  struct buf *buffer_ptr;
+
+  for(buffer_ptr = *bucket_head(hash); buffer_ptr; buffer_ptr = buffer_ptr->next){
+    if(buffer_ptr->dev == dev && buffer_ptr->blockno == blockno && bhold(buffer_ptr))
+      return buffer_ptr;
+  }
+  return 0;
+}
+
+// 让缓冲区缓存指定的块，并加入替换队列和哈希桶
+// 调用者必须持有该块所在哈希桶的锁，缓冲区的refcnt必须是BUF_BUSY
+static void
+binsert(struct buf *buffer_ptr, uint dev, uint blockno, uint hash)
+{
+  struct buf **head = bucket_head(hash);
+
+  buffer_ptr->dev = dev;
+  buffer_ptr->blockno = blockno;
+  buffer_ptr->valid = 0;
+  buffer_ptr->refcnt = 1;
+  bqueue_add(buffer_ptr, ghosttake(dev, blockno));
+  buffer_ptr->next = *head;
+  // 初始化完成后才让无锁查找看到该缓冲区
+  __atomic_store_n(head, buffer_ptr, __ATOMIC_RELEASE);
+  this_cpu_inc(&bstats.misses);
 }
 
 // 在缓冲区缓存中查找指定的块
@@ -78,90 +547,65 @@ calculate_hash_index(uint blockno)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *buffer_ptr;
-  // 计算哈希桶索引
-  int bucket_index = calculate_hash_index(blockno);
-  struct buf *prev_ptr, *min_buffer_ptr = 0, *min_prev_ptr;
-  uint min_timestamp;
-  int i;
+  struct buf *buffer_ptr, *victim;
+  // 计算哈希值
+  uint hash = bhash(dev, blockno);
 
-  // 在指定哈希桶中查找缓冲区
-  acquire(&buffer_cache.bucket_locks[bucket_index]);
-  for(buffer_ptr = buffer_cache.hash_buckets[bucket_index].next; buffer_ptr; buffer_ptr = buffer_ptr->next){
-    if(buffer_ptr->dev == dev && buffer_ptr->blockno == blockno){
-      buffer_ptr->refcnt++;
-      release(&buffer_cache.bucket_locks[bucket_index]);
-      acquiresleep(&buffer_ptr->lock);
-      return buffer_ptr;
-    }
+  // 快速路径：无锁查找
+  if((buffer_ptr = blookup(dev, blockno, hash)) != 0) {
+    bhit(buffer_ptr);
+    acquiresleep(&buffer_ptr->lock);
+    return buffer_ptr;
+  }
+
+  // 持锁在指定哈希桶中再查找一次
+  acquire(bucket_lock(hash));
+  if((buffer_ptr = bfind(hash, dev, blockno)) != 0) {
+    release(bucket_lock(hash));
+    bhit(buffer_ptr);
+    acquiresleep(&buffer_ptr->lock);
+    return buffer_ptr;
   }
 
-  // 缓存中未找到，检查是否有未使用的缓冲区
+  // 缓存中未找到，检查空闲链表中是否有未使用的缓冲区
   acquire(&buffer_cache.global_lock);
-  if(buffer_cache.allocated_buffer_count < NBUF) {
-    buffer_ptr = &buffer_cache.buffer_pool[buffer_cache.allocated_buffer_count++];
+  if((buffer_ptr = buffer_cache.free_list) != 0) {
+    buffer_cache.free_list = buffer_ptr->next;
+    buffer_ptr->free = 0;
     release(&buffer_cache.global_lock);
-    buffer_ptr->dev = dev;
-    buffer_ptr->blockno = blockno;
-    buffer_ptr->valid = 0;
-    buffer_ptr->refcnt = 1;
-    buffer_ptr->timestamp = ticks;
-    buffer_ptr->next = buffer_cache.hash_buckets[bucket_index].next;
-    buffer_cache.hash_buckets[bucket_index].next = buffer_ptr;
-    release(&buffer_cache.bucket_locks[bucket_index]);
+    binsert(buffer_ptr, dev, blockno, hash);
+    release(bucket_lock(hash));
     acquiresleep(&buffer_ptr->lock);
     return buffer_ptr;
   }
   release(&buffer_cache.global_lock);
-  release(&buffer_cache.bucket_locks[bucket_index]);
-
-  // 从所有哈希桶中选择最近最少使用的块进行替换
-  // 基于时间戳的LRU替换策略
-  acquire(&buffer_cache.eviction_lock);
-  for(i = 0; i < HASH_BUCKET_COUNT; ++i) {
-      min_timestamp = -1;
-      acquire(&buffer_cache.bucket_locks[bucket_index]);
-      for(prev_ptr = &buffer_cache.hash_buckets[bucket_index], buffer_ptr = prev_ptr->next; buffer_ptr; prev_ptr = buffer_ptr, buffer_ptr = buffer_ptr->next) {
-          // 再次检查是否在其他线程操作期间找到了该块
-          if(bucket_index == calculate_hash_index(blockno) && buffer_ptr->dev == dev && buffer_ptr->blockno == blockno){
-              buffer_ptr->refcnt++;
-              release(&buffer_cache.bucket_locks[bucket_index]);
-              release(&buffer_cache.eviction_lock);
-              acquiresleep(&buffer_ptr->lock);
-              return buffer_ptr;
-          }
-          if(buffer_ptr->refcnt == 0 && buffer_ptr->timestamp < min_timestamp) {
-              min_buffer_ptr = buffer_ptr;
-              min_prev_ptr = prev_ptr;
-              min_timestamp = buffer_ptr->timestamp;
-          }
-      }
-      // 找到一个未使用的块进行替换
-      if(min_buffer_ptr) {
-          min_buffer_ptr->dev = dev;
-          min_buffer_ptr->blockno = blockno;
-          min_buffer_ptr->valid = 0;
-          min_buffer_ptr->refcnt = 1;
-          // 如果块在其他桶中，需要将其移动到正确的桶
-          if(bucket_index != calculate_hash_index(blockno)) {
-              min_prev_ptr->next = min_buffer_ptr->next;    // 从当前桶移除
-              release(&buffer_cache.bucket_locks[bucket_index]);
-              bucket_index = calculate_hash_index(blockno);  // 获取正确的桶索引
-              acquire(&buffer_cache.bucket_locks[bucket_index]);
-              min_buffer_ptr->next = buffer_cache.hash_buckets[bucket_index].next;    // 移动到正确的桶
-              buffer_cache.hash_buckets[bucket_index].next = min_buffer_ptr;
-          }
-          release(&buffer_cache.bucket_locks[bucket_index]);
-          release(&buffer_cache.eviction_lock);
-          acquiresleep(&min_buffer_ptr->lock);
-          return min_buffer_ptr;
-      }
-      release(&buffer_cache.bucket_locks[bucket_index]);
-      if(++bucket_index == HASH_BUCKET_COUNT) {
-          bucket_index = 0;
-      }
+  release(bucket_lock(hash));
+
+  // 尚未达到容量上限时，先扩容再重试，而不是驱逐正在使用的块
+  if(bgrow())
+    return bget(dev, blockno);
+
+  // 按2Q策略驱逐一个缓冲区
+  if((victim = bevict()) == 0)
+    panic("bget: no buffers");
+
+  // 驱逐期间其他进程可能已经读入了该块，此时把驱逐出的缓冲区放回空闲链表
+  acquire(bucket_lock(hash));
+  if((buffer_ptr = bfind(hash, dev, blockno)) != 0) {
+    release(bucket_lock(hash));
+    acquire(&buffer_cache.global_lock);
+    victim->free = 1;
+    victim->next = buffer_cache.free_list;
+    buffer_cache.free_list = victim;
+    release(&buffer_cache.global_lock);
+    bhit(buffer_ptr);
+    acquiresleep(&buffer_ptr->lock);
+    return buffer_ptr;
   }
-  panic("bget: no buffers");
+  binsert(victim, dev, blockno, hash);
+  release(bucket_lock(hash));
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // 返回带有指定块内容的已锁定缓冲区
@@ -173,12 +617,95 @@ bread(uint dev, uint blockno)
 
   buffer_ptr = bget(dev, blockno);
   if(!buffer_ptr->valid) {
-    virtio_disk_rw(buffer_ptr, 0);
-    buffer_ptr->valid = 1;
+    // 预读可能正在进行，等它完成
+    virtio_disk_wait(buffer_ptr);
+    if(!buffer_ptr->valid) {
+      virtio_disk_rw(buffer_ptr, 0);
+      buffer_ptr->valid = 1;
+    }
   }
   return buffer_ptr;
 }
 
+// 读入从blockno开始的n个连续块，bufs[i]返回第i块的已锁定缓冲区
+// 不在缓存中的连续块合并为一个磁盘请求，所有请求同时发出
+void
+bread_range(uint dev, uint blockno, int n, struct buf **bufs)
+{
+  int i, j;
+
+  for(i = 0; i < n; i++) {
+    bufs[i] = bget(dev, blockno + i);
+    // 预读可能正在进行，等它完成
+    if(!bufs[i]->valid)
+      virtio_disk_wait(bufs[i]);
+  }
+  for(i = 0; i < n; i = j) {
+    if(bufs[i]->valid) {
+      j = i + 1;
+      continue;
+    }
+    for(j = i; j < n && !bufs[j]->valid; j++)
+      ;
+    virtio_disk_start(bufs + i, j - i, 0);
+  }
+  for(i = 0; i < n; i++) {
+    if(!bufs[i]->valid) {
+      virtio_disk_wait(bufs[i]);
+      bufs[i]->valid = 1;
+    }
+  }
+}
+
+// 预读完成时由virtio_disk_intr调用（持有vdisk_lock）：
+// 标记数据有效，并释放bread_async保留的引用
+static void
+bread_async_done(struct buf *buffer_ptr)
+{
+  buffer_ptr->valid = 1;
+  bunpin(buffer_ptr);
+}
+
+// 开始读入blocknos[0..n)中的块，不等待读完，块号为0的项跳过
+// 读取期间缓冲区保留一个引用，不会被驱逐；之后的bread会等待读完
+// 块已在缓存中或正在读入时什么也不做
+// 返回已处理的项数：磁盘请求已满、无法继续读取时小于n
+int
+bread_async(uint dev, uint *blocknos, int n)
+{
+  struct buf *pending[ASYNC_BATCH];
+  int where[ASYNC_BATCH];
+  struct buf *buffer_ptr;
+  int i, j, k = 0, started;
+
+  for(i = 0; i <= n; i++) {
+    if(i < n && blocknos[i]) {
+      buffer_ptr = bget(dev, blocknos[i]);
+      // 持有缓冲区锁时disk为1说明预读正在进行
+      if(buffer_ptr->valid || buffer_ptr->disk) {
+        brelse(buffer_ptr);
+      } else {
+        where[k] = i;
+        pending[k++] = buffer_ptr;
+      }
+    }
+    if(k == ASYNC_BATCH || (i == n && k > 0)) {
+      // 连续的块由驱动合并为一个请求
+      started = virtio_disk_read_async(pending, k, bread_async_done);
+      for(j = 0; j < k; j++) {
+        if(j < started)
+          releasesleep(&pending[j]->lock);
+        else
+          brelse(pending[j]);
+      }
+      if(started < k)
+        return where[started];
+      k = 0;
+    }
+  }
+  return n;
+}
+
 // 将缓冲区内容写入磁盘
 // 调用者必须持有缓冲区锁
 void
@@ -189,47 +716,298 @@ bwrite(struct buf *buffer_ptr)
   virtio_disk_rw(buffer_ptr, 1);
 }
 
+// 将n个缓冲区的内容写入磁盘，并等待全部写完
+// 块号连续的缓冲区合并为一个磁盘请求
+// 调用者必须持有所有缓冲区的锁
+void
+bwrite_range(struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwrite_range");
+  virtio_disk_rw_vec(bufs, n, 1);
+}
+
 // 释放已锁定的缓冲区
-// 移动到最近使用列表的头部
+// 替换顺序由所在的队列决定，这里只需减少引用计数
 void
 brelse(struct buf *buffer_ptr)
 {
-  int bucket_index;
   if(!holdingsleep(&buffer_ptr->lock))
     panic("brelse");
 
   releasesleep(&buffer_ptr->lock);
 
-  // 获取对应哈希桶的锁
-  bucket_index = calculate_hash_index(buffer_ptr->blockno);
-  acquire(&buffer_cache.bucket_locks[bucket_index]);
-  buffer_ptr->refcnt--;
-  if (buffer_ptr->refcnt == 0) {
-    // 更新时间戳以记录最近访问时间
-    buffer_ptr->timestamp = ticks;
-  }
-  
-  release(&buffer_cache.bucket_locks[bucket_index]);
+  // 引用计数由原子操作维护，无需持有哈希桶的锁
+  bput(buffer_ptr);
 }
 
 // 增加缓冲区的引用计数（固定缓冲区）
 // 防止缓冲区被回收
 void
 bpin(struct buf *buffer_ptr) {
-  // 获取缓冲区对应哈希桶的锁
-  int bucket_index = calculate_hash_index(buffer_ptr->blockno);
-  acquire(&buffer_cache.bucket_locks[bucket_index]);
-  buffer_ptr->refcnt++;
-  release(&buffer_cache.bucket_locks[bucket_index]);
+  __sync_fetch_and_add(&buffer_ptr->refcnt, 1);
 }
 
 // 减少缓冲区的引用计数（取消固定缓冲区）
 // 允许缓冲区被回收
 void
 bunpin(struct buf *buffer_ptr) {
-  // 获取缓冲区对应哈希桶的锁
-  int bucket_index = calculate_hash_index(buffer_ptr->blockno);
-  acquire(&buffer_cache.bucket_locks[bucket_index]);
-  buffer_ptr->refcnt--;
-  release(&buffer_cache.bucket_locks[bucket_index]);
-}
\ No newline at end of file
+  __sync_fetch_and_sub(&buffer_ptr->refcnt, 1);
+}
+
+// 丢弃所有未被使用的缓冲区，把它们放回空闲链表
+// 用于测量冷缓存下的读取性能
+void
+bdrop(void)
+{
+  struct buf_page *page;
+  struct buf *buffer_ptr;
+
+  acquire(&buffer_cache.grow_lock);
+  for(buffer_ptr = buffer_cache.buffer_pool; buffer_ptr < buffer_cache.buffer_pool + NBUF; buffer_ptr++)
+    bdiscard(buffer_ptr);
+  for(page = buffer_cache.pages; page; page = page->next)
+    for(buffer_ptr = page->bufs; buffer_ptr < page->bufs + BUF_PER_PAGE; buffer_ptr++)
+      bdiscard(buffer_ptr);
+  release(&buffer_cache.grow_lock);
+}
+
+// 汇总所有CPU的命中与未命中次数
+void
+bcachestat(int *hits, int *misses)
+{
+  int i;
+
+  *hits = *misses = 0;
+  for(i = 0; i < NCPU; i++) {
+    *hits += per_cpu_ptr(&bstats, i)->hits;
+    *misses += per_cpu_ptr(&bstats, i)->misses;
+  }
+}
+
+// 格式化哈希表的链长统计：桶数、最长的链和各长度的链的数目
+int
+bhashstats(char *buf, int sz)
+{
+  int hist[9], len, max = 0, i, n;
+  uint index, nbuckets = __atomic_load_n(&buffer_cache.geometry, __ATOMIC_ACQUIRE);
+  struct buf *buffer_ptr;
+
+  memset(hist, 0, sizeof(hist));
+  for(index = 0; index < nbuckets; index++) {
+    acquire(bucket_lock(index));
+    len = 0;
+    for(buffer_ptr = *bucket_slot(index); buffer_ptr; buffer_ptr = buffer_ptr->next)
+      len++;
+    release(bucket_lock(index));
+    hist[len < 8 ? len : 8]++;
+    if(len > max)
+      max = len;
+  }
+  n = snprintf(buf, sz, "bcache hash: %d buckets, longest chain %d, chains of length", nbuckets, max);
+  for(i = 0; i < 9; i++)
+    n += snprintf(buf+n, sz-n, " %d%s:%d", i, i == 8 ? "+" : "", hist[i]);
+  n += snprintf(buf+n, sz-n, "\n");
+  return n;
+}
+
+// 分裂下一个桶：设桶数为n，不超过n的最大2的幂为half，
+// 把桶n - half中应落在新桶n的缓冲区移过去
+// 调用者必须持有grow_lock，新桶所在的目录页必须已经分配
+static void
+bsplit(void)
+{
+  uint64 geometry = buffer_cache.geometry;
+  uint n = geometry, half = geometry >> 32;
+  struct buf **pp, **head = bucket_slot(n), *buffer_ptr;
+  // 两个桶共用这把锁
+  struct spinlock *lk = bucket_lock(n);
+
+  acquire(lk);
+  for(pp = bucket_slot(n - half); (buffer_ptr = *pp) != 0; ) {
+    if((bhash(buffer_ptr->dev, buffer_ptr->blockno) & (2 * half - 1)) != n) {
+      pp = &buffer_ptr->next;
+      continue;
+    }
+    // 正在旧桶中查找的无锁查找可能跟着被移动的缓冲区进入新桶，
+    // 从而错过旧桶中剩下的缓冲区，之后会持锁再查找一次
+    __atomic_store_n(pp, buffer_ptr->next, __ATOMIC_RELEASE);
+    buffer_ptr->next = *head;
+    __atomic_store_n(head, buffer_ptr, __ATOMIC_RELEASE);
+  }
+  if(++n == 2 * half)
+    half = n;
+  __atomic_store_n(&buffer_cache.geometry, ((uint64)half << 32) | n, __ATOMIC_RELEASE);
+  release(lk);
+}
+
+// 从kalloc分配一页缓冲区并放入空闲链表，并分裂哈希桶使桶数跟上缓冲区数
+// 成功（或其他进程已经扩容）时返回1，
+// 已达到容量上限或内存不足时返回0
+static int
+bgrow(void)
+{
+  struct buf_page *page;
+  struct buf *buffer_ptr;
+  struct buf **spare = 0;
+  uint n;
+
+  acquire(&buffer_cache.global_lock);
+  if(buffer_cache.buffer_count + BUF_PER_PAGE > buffer_cache.max_buffer_count) {
+    release(&buffer_cache.global_lock);
+    return 0;
+  }
+  release(&buffer_cache.global_lock);
+
+  // kalloc可能调用bshrink，所以此时不能持有任何缓存的锁
+  if((page = kalloc()) == 0)
+    return 0;
+  // 分裂出的新桶可能需要一页新的目录
+  n = (uint)buffer_cache.geometry + BUF_PER_PAGE;
+  if(n < buffer_cache.max_buckets && buffer_cache.directory[n / HASH_DIR_SIZE] == 0)
+    spare = kalloc();
+  for(buffer_ptr = page->bufs; buffer_ptr < page->bufs + BUF_PER_PAGE; buffer_ptr++) {
+    initsleeplock(&buffer_ptr->lock, "buffer");
+    buffer_ptr->refcnt = BUF_BUSY;
+    buffer_ptr->free = 1;
+    buffer_ptr->list = BQ_NONE;
+    buffer_ptr->dev = 0;
+    buffer_ptr->blockno = 0;
+  }
+
+  acquire(&buffer_cache.grow_lock);
+  acquire(&buffer_cache.global_lock);
+  // 其他进程可能同时完成了扩容
+  if(buffer_cache.buffer_count + BUF_PER_PAGE > buffer_cache.max_buffer_count) {
+    release(&buffer_cache.global_lock);
+    release(&buffer_cache.grow_lock);
+#ifdef LAB_LOCK
+    for(buffer_ptr = page->bufs; buffer_ptr < page->bufs + BUF_PER_PAGE; buffer_ptr++)
+      freelock(&buffer_ptr->lock.lk);
+#endif
+    kfree(page);
+    if(spare)
+      kfree(spare);
+    return 1;
+  }
+  page->next = buffer_cache.pages;
+  buffer_cache.pages = page;
+  buffer_cache.buffer_count += BUF_PER_PAGE;
+  for(buffer_ptr = page->bufs; buffer_ptr < page->bufs + BUF_PER_PAGE; buffer_ptr++) {
+    buffer_ptr->next = buffer_cache.free_list;
+    buffer_cache.free_list = buffer_ptr;
+  }
+  release(&buffer_cache.global_lock);
+
+  // buffer_count只在持有grow_lock时改变
+  while((n = buffer_cache.geometry) < buffer_cache.buffer_count && n < buffer_cache.max_buckets) {
+    if(buffer_cache.directory[n / HASH_DIR_SIZE] == 0) {
+      if(spare == 0)
+        break;
+      memset(spare, 0, PGSIZE);
+      __atomic_store_n(&buffer_cache.directory[n / HASH_DIR_SIZE], spare, __ATOMIC_RELEASE);
+      spare = 0;
+    }
+    bsplit();
+  }
+  release(&buffer_cache.grow_lock);
+  if(spare)
+    kfree(spare);
+  return 1;
+}
+
+// 宽限期结束后释放缓冲区页
+static void
+freebufpage(struct rcuhead *head)
+{
+  kfree((struct buf_page*)head);
+}
+
+// 从空闲链表或哈希桶中取下一个未被使用的缓冲区，使其不再能被找到
+// 缓冲区正被使用时返回0
+static int
+bclaim(struct buf *buffer_ptr)
+{
+  struct buf **pp;
+
+  acquire(&buffer_cache.global_lock);
+  if(buffer_ptr->free) {
+    for(pp = &buffer_cache.free_list; *pp != buffer_ptr; pp = &(*pp)->next)
+      ;
+    *pp = buffer_ptr->next;
+    buffer_ptr->free = 0;
+    release(&buffer_cache.global_lock);
+    return 1;
+  }
+  release(&buffer_cache.global_lock);
+
+  // 不在空闲链表中而引用计数为0的缓冲区一定在某个队列和哈希桶中；
+  // 置为BUF_BUSY之后，驱逐者不会再移动它
+  if(!__sync_bool_compare_and_swap(&buffer_ptr->refcnt, 0, BUF_BUSY))
+    return 0;
+  if(buffer_ptr->dirty)
+    panic("bclaim: dirty");
+  bqueue_remove(buffer_ptr);
+  bunlink(buffer_ptr);
+  return 1;
+}
+
+// 若缓冲区未被使用，把它从哈希表中取下并放回空闲链表
+// 调用者必须持有grow_lock
+static void
+bdiscard(struct buf *buffer_ptr)
+{
+  if(buffer_ptr->free || !bclaim(buffer_ptr))
+    return;
+  acquire(&buffer_cache.global_lock);
+  buffer_ptr->free = 1;
+  buffer_ptr->next = buffer_cache.free_list;
+  buffer_cache.free_list = buffer_ptr;
+  release(&buffer_cache.global_lock);
+}
+
+// 内存不足时由kalloc调用：归还最多n页完全未被使用的缓冲区页
+// 静态缓冲区池从不归还
+// 返回归还的页数；这些页要等rcu宽限期结束后才回到kalloc
+static int
+bshrink(int n)
+{
+  struct buf_page *page, **pp;
+  struct buf *buffer_ptr;
+  int claimed, freed = 0;
+
+  acquire(&buffer_cache.grow_lock);
+  for(pp = &buffer_cache.pages; (page = *pp) != 0 && freed < n; ) {
+    for(claimed = 0; claimed < BUF_PER_PAGE; claimed++) {
+      if(!bclaim(&page->bufs[claimed]))
+        break;
+    }
+    if(claimed < BUF_PER_PAGE) {
+      // 有缓冲区正被使用，把已取下的缓冲区放回空闲链表
+      acquire(&buffer_cache.global_lock);
+      for(buffer_ptr = page->bufs; buffer_ptr < page->bufs + claimed; buffer_ptr++) {
+        buffer_ptr->free = 1;
+        buffer_ptr->next = buffer_cache.free_list;
+        buffer_cache.free_list = buffer_ptr;
+      }
+      release(&buffer_cache.global_lock);
+      pp = &page->next;
+      continue;
+    }
+    *pp = page->next;
+    acquire(&buffer_cache.global_lock);
+    buffer_cache.buffer_count -= BUF_PER_PAGE;
+    release(&buffer_cache.global_lock);
+#ifdef LAB_LOCK
+    for(buffer_ptr = page->bufs; buffer_ptr < page->bufs + BUF_PER_PAGE; buffer_ptr++)
+      freelock(&buffer_ptr->lock.lk);
+#endif
+    call_rcu(&page->rcu, freebufpage);
+    freed++;
+  }
+  release(&buffer_cache.grow_lock);
+  return freed;
+}
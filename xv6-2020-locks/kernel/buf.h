@@ -1,6 +1,8 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  void (*iodone)(struct buf*);  // 异步读完成时由virtio_disk_intr调用
+  int dirty;   // 已提交到日志但尚未写回原位置（见log.c），此时不得被回收
   uint dev;
   uint blockno;
   struct sleeplock lock;
@@ -10,6 +12,12 @@ struct buf {
   // 使用这个来当哈希表
   struct buf *next;
   uchar data[BSIZE];
-  // 记录最后使用缓存块的时间
-  uint timestamp;
+  // 所在的替换队列（见bio.c中的2Q策略）
+  struct buf *qprev;
+  struct buf *qnext;
+  int queue;   // 队列所属CPU的编号
+  int list;    // 在A1还是Am中，或不在任何队列中
+  int ref;     // 在Am中时，上次驱逐检查以来是否被命中过
+  // 是否在空闲链表中（尚未加入哈希表）
+  int free;
 };
\ No newline at end of file
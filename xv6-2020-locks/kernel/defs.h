@@ -4,6 +4,10 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rastate;
+struct rcuhead;
+struct rwlock;
+struct seqlock;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -16,10 +20,16 @@ struct sock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            bread_range(uint, uint, int, struct buf**);
+int             bread_async(uint, uint*, int);
+void            bdrop(void);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_range(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bcachestat(int*, int*);
+int             bhashstats(char*, int);
 
 // console.c
 void            consoleinit(void);
@@ -54,6 +64,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            readahead(struct inode*, struct rastate*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -67,12 +78,18 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            registershrinker(int (*)(int));
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            logsync(void);
+
+// percpu.c
+void            percpuinithart(void);
+int             cpuid(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -86,7 +103,6 @@ void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
 // proc.c
-int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
@@ -105,6 +121,7 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            kthread(char*, void (*)(void));
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -116,13 +133,37 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlocktype(struct spinlock*, char*, int);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             lockbench(int, int, uint64*);
 #ifdef LAB_LOCK
 void            freelock(struct spinlock*);
+void            lockcount(struct spinlock*, int, int);
 #endif
 
+// rcu.c
+void            rcuinit(void);
+void            rcu_read_lock(void);
+void            rcu_read_unlock(void);
+void            call_rcu(struct rcuhead*, void (*)(struct rcuhead*));
+void            rcuqs(void);
+void            rcupoll(void);
+
+// rwlock.c
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+int             holdingwrite(struct rwlock*);
+void            initseqlock(struct seqlock*, char*);
+void            acquireseq(struct seqlock*);
+void            releaseseq(struct seqlock*);
+uint            readseqbegin(struct seqlock*);
+int             readseqretry(struct seqlock*, uint);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -150,7 +191,7 @@ void            syscall();
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
+extern struct seqlock tickslock;
 void            usertrapret(void);
 
 // uart.c
@@ -187,6 +228,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rw_vec(struct buf **, int, int);
+void            virtio_disk_start(struct buf **, int, int);
+int             virtio_disk_read_async(struct buf **, int, void (*)(struct buf *));
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -1,3 +1,10 @@
+// Readahead state of an open file; see readahead() in fs.c.
+struct rastate {
+  uint next;    // block after the last one read
+  uint ahead;   // first block not yet read ahead
+  uint window;  // how many blocks to read ahead; 0 if reads look random
+};
+
 struct file {
 #ifdef LAB_NET
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SOCK } type;
@@ -13,6 +20,7 @@ struct file {
   struct sock *sock; // FD_SOCK
 #endif
   uint off;          // FD_INODE
+  struct rastate ra; // FD_INODE
   short major;       // FD_DEVICE
 };
 
@@ -22,6 +22,10 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+// readahead window, in blocks.
+#define RA_MIN 4
+#define RA_MAX 32
+
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -165,7 +169,15 @@ bfree(int dev, uint b)
 // The icache.lock spin-lock protects the allocation of icache
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// holds, one must hold icache.lock to change ip->dev or ip->inum,
+// or to drop the last reference. Looking up an entry, and taking
+// or dropping any other reference, needs no lock: ip->ref is only
+// updated atomically, and iget() checks that an entry it found
+// without the lock still holds the same i-node once it has taken
+// a reference, since entries are recycled but never freed.
+// An entry whose last reference has gone keeps its dev and inum
+// (and, if ip->valid, its contents) until it is recycled, so a
+// later iget() of the same inode finds it without the lock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -176,6 +188,10 @@ struct {
   struct inode inode[NINODE];
 } icache;
 
+// Set in ip->ref while iget() gives an entry a new identity,
+// so that lookups without icache.lock cannot take it.
+#define IREF_BUSY 0x40000000
+
 void
 iinit()
 {
@@ -236,37 +252,74 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Take a reference to ip without icache.lock.
+// Fails if iget() is recycling ip.
+static int
+ihold(struct inode *ip)
+{
+  int r;
+
+  for(;;){
+    r = __atomic_load_n(&ip->ref, __ATOMIC_RELAXED);
+    if(r & IREF_BUSY)
+      return 0;
+    if(__sync_bool_compare_and_swap(&ip->ref, r, r + 1))
+      return 1;
+  }
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Must be called inside a transaction since it may call iput().
 static struct inode*
 iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&icache.lock);
-
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
+  rcu_read_lock();
+  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++)
+    if(ip->dev == dev && ip->inum == inum)
+      break;
+  if(ip < &icache.inode[NINODE] && ihold(ip)){
+    rcu_read_unlock();
+    if(ip->dev == dev && ip->inum == inum)
       return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+    // recycled before the reference was taken.
+    iput(ip);
+  } else {
+    rcu_read_unlock();
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Look again with the lock, since another process may
+  // be adding or recycling entries.
+  acquire(&icache.lock);
+  for(;;){
+    empty = 0;
+    for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
+      if(ip->dev == dev && ip->inum == inum){
+        __sync_fetch_and_add(&ip->ref, 1);
+        release(&icache.lock);
+        return ip;
+      }
+      if(empty == 0 && ip->ref == 0)    // Remember empty slot.
+        empty = ip;
+    }
+
+    // Recycle an inode cache entry, unless a lookup
+    // without the lock has just taken it.
+    if(empty == 0)
+      panic("iget: no inodes");
+    if(__sync_bool_compare_and_swap(&empty->ref, 0, IREF_BUSY))
+      break;
+  }
 
   ip = empty;
   ip->dev = dev;
   ip->inum = inum;
-  ip->ref = 1;
   ip->valid = 0;
+  __atomic_store_n(&ip->ref, 1, __ATOMIC_RELEASE);
   release(&icache.lock);
 
   return ip;
@@ -277,9 +330,7 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
   return ip;
 }
 
@@ -332,6 +383,13 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  int r;
+
+  // Drop a reference that is not the last one.
+  while((r = __atomic_load_n(&ip->ref, __ATOMIC_RELAXED)) > 1)
+    if(__sync_bool_compare_and_swap(&ip->ref, r, r - 1))
+      return;
+
   acquire(&icache.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
@@ -353,7 +411,7 @@ iput(struct inode *ip)
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  __sync_fetch_and_sub(&ip->ref, 1);
   release(&icache.lock);
 }
 
@@ -476,6 +534,75 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Before a read of n bytes at off from an open file, start
+// reading the blocks that a sequential reader will want next,
+// along with the blocks of this read, so that the disk works
+// on them in parallel instead of one bread() at a time. The
+// window starts at RA_MIN blocks when reads look sequential,
+// doubles up to RA_MAX each time the reader catches up with
+// it, and halves on each read that is not sequential.
+// Caller must hold ip->lock.
+void
+readahead(struct inode *ip, struct rastate *ra, uint off, uint n)
+{
+  uint first, last, end, bn, nblocks, i;
+  uint addrs[RA_MAX];
+  struct buf *bp;
+
+  if(off >= ip->size || n == 0)
+    return;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  first = off / BSIZE;
+  last = (off + n - 1) / BSIZE + 1;
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+
+  // reads smaller than a block continue in the last block read.
+  if(first != ra->next && first + 1 != ra->next){
+    ra->window /= 2;
+    ra->next = last;
+    ra->ahead = 0;
+    return;
+  }
+  ra->next = last;
+  if(ra->window == 0)
+    ra->window = RA_MIN;
+  if(ra->ahead >= last + ra->window / 2)
+    return;   // enough is on its way.
+  if(ra->ahead > first && ra->window < RA_MAX)
+    ra->window *= 2;
+
+  bn = ra->ahead > first ? ra->ahead : first;
+  end = last + ra->window;
+  if(end > nblocks)
+    end = nblocks;
+  if(end > bn + RA_MAX)
+    end = bn + RA_MAX;
+  if(bn >= end)
+    return;
+
+  // look the blocks up without allocating, as bmap() would.
+  for(i = 0; bn + i < end && bn + i < NDIRECT; i++)
+    addrs[i] = ip->addrs[bn + i];
+  if(bn + i < end){
+    if(ip->addrs[NDIRECT] == 0)
+      end = bn + i;
+    else {
+      bp = bread(ip->dev, ip->addrs[NDIRECT]);
+      for(; bn + i < end; i++)
+        addrs[i] = ((uint*)bp->data)[bn + i - NDIRECT];
+      brelse(bp);
+    }
+  } else if(end + ra->window > NDIRECT && ip->addrs[NDIRECT]){
+    // the next window will need the indirect block.
+    bread_async(ip->dev, &ip->addrs[NDIRECT], 1);
+  }
+
+  // consecutive blocks go to the disk as one request. if the
+  // disk queue fills up, try the rest again next read.
+  ra->ahead = bn + bread_async(ip->dev, addrs, end - bn);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -7,6 +7,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "percpu.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
@@ -21,23 +22,38 @@ struct free_page_node {
 
 // 每CPU内存分配器：减少锁竞争，提升并发性能
 // 每个CPU维护独立的空闲页面链表和锁
+// 放在每CPU数据区中，各CPU的分配器不会共享缓存行
 struct per_cpu_allocator {
   struct spinlock lock;              // 保护该CPU空闲链表的锁
   struct free_page_node *freelist;  // 该CPU的空闲页面链表
   char lock_name[16];                // 锁的名称 (便于调试)
-} cpu_allocators[NCPU];
+  int cpu_id;                        // 所属CPU的编号
+};
+static DEFINE_PERCPU(struct per_cpu_allocator, cpu_allocator);
+
+// 内存不足时调用的回收函数，例如缓冲区缓存的bshrink
+// 参数为希望归还的页数，返回实际归还的页数
+#define NSHRINKER 4
+#define SHRINK_PAGES 16
+static struct {
+  int (*scan[NSHRINKER])(int);
+  int n;
+} shrinkers;
 
 // 初始化每CPU内存分配器
 void
 kinit()
 {
+  struct per_cpu_allocator *allocator;
   int cpu_index;
   
   // 为每个CPU初始化独立的分配器
   for (cpu_index = 0; cpu_index < NCPU; ++cpu_index) {
-    snprintf(cpu_allocators[cpu_index].lock_name, 16, "kmem_cpu_%d", cpu_index);
-    initlock(&cpu_allocators[cpu_index].lock, cpu_allocators[cpu_index].lock_name);
-    cpu_allocators[cpu_index].freelist = 0;  // 初始化为空链表
+    allocator = per_cpu_ptr(&cpu_allocator, cpu_index);
+    snprintf(allocator->lock_name, 16, "kmem_cpu_%d", cpu_index);
+    initlock(&allocator->lock, allocator->lock_name);
+    allocator->freelist = 0;  // 初始化为空链表
+    allocator->cpu_id = cpu_index;
   }
   
   // 将所有可用内存添加到当前CPU的空闲链表中
@@ -60,7 +76,7 @@ void
 kfree(void *pa)
 {
   struct free_page_node *free_page;
-  int current_cpu_id;
+  struct per_cpu_allocator *allocator;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
@@ -70,16 +86,36 @@ kfree(void *pa)
 
   free_page = (struct free_page_node*)pa;
 
-  // 获取当前CPU ID (关闭中断防止CPU切换)
-  push_off();
-  current_cpu_id = cpuid();
-  pop_off();
-  
+  // 通过tp直接找到当前CPU的分配器，无需关闭中断：
+  // 即使随后被调度到其他CPU，分配器也由自己的锁保护
+  allocator = this_cpu_ptr(&cpu_allocator);
+
   // 将页面添加到当前CPU的空闲链表头部
-  acquire(&cpu_allocators[current_cpu_id].lock);
-  free_page->next = cpu_allocators[current_cpu_id].freelist;
-  cpu_allocators[current_cpu_id].freelist = free_page;
-  release(&cpu_allocators[current_cpu_id].lock);
+  acquire(&allocator->lock);
+  free_page->next = allocator->freelist;
+  allocator->freelist = free_page;
+  release(&allocator->lock);
+}
+
+// 注册一个回收函数，在kalloc找不到空闲页面时调用
+// 只在启动时由单个CPU调用
+void
+registershrinker(int (*scan)(int))
+{
+  if(shrinkers.n == NSHRINKER)
+    panic("registershrinker");
+  shrinkers.scan[shrinkers.n++] = scan;
+}
+
+// 让各个回收函数归还内存，返回归还的页数
+static int
+shrink(void)
+{
+  int i, freed = 0;
+
+  for(i = 0; i < shrinkers.n && freed < SHRINK_PAGES; i++)
+    freed += shrinkers.scan[i](SHRINK_PAGES - freed);
+  return freed;
 }
 
 // 从其他CPU"窃取"页面：当当前CPU空闲链表为空时使用
@@ -90,6 +126,7 @@ steal_pages_from_other_cpu(int current_cpu_id)
 {
     int checked_cpu_count;
     int target_cpu_id = current_cpu_id;
+    struct per_cpu_allocator *target;
     struct free_page_node *fast_ptr, *slow_ptr, *stolen_list_head;
     
     // 轮询检查其他CPU的空闲链表
@@ -99,10 +136,11 @@ steal_pages_from_other_cpu(int current_cpu_id)
             target_cpu_id = 0;
         }
         
-        acquire(&cpu_allocators[target_cpu_id].lock);
-        if (cpu_allocators[target_cpu_id].freelist) {
+        target = per_cpu_ptr(&cpu_allocator, target_cpu_id);
+        acquire(&target->lock);
+        if (target->freelist) {
             // 使用快慢指针算法找到链表中点，窃取前半部分
-            slow_ptr = stolen_list_head = cpu_allocators[target_cpu_id].freelist;
+            slow_ptr = stolen_list_head = target->freelist;
             fast_ptr = slow_ptr->next;
             
             // 快指针每次移动2步，慢指针每次移动1步
@@ -115,14 +153,14 @@ steal_pages_from_other_cpu(int current_cpu_id)
             }
             
             // 将目标CPU的空闲链表从中点处断开
-            cpu_allocators[target_cpu_id].freelist = slow_ptr->next;
-            release(&cpu_allocators[target_cpu_id].lock);
+            target->freelist = slow_ptr->next;
+            release(&target->lock);
             
             // 断开窃取的链表
             slow_ptr->next = 0;
             return stolen_list_head;
         }
-        release(&cpu_allocators[target_cpu_id].lock);
+        release(&target->lock);
     }
     return 0;  // 所有CPU都没有空闲页面
 }
@@ -134,28 +172,32 @@ void *
 kalloc(void)
 {
   struct free_page_node *allocated_page;
-  int current_cpu_id;
+  struct per_cpu_allocator *allocator;
   
-  // 获取当前CPU ID (关闭中断防止CPU切换)
-  push_off();
-  current_cpu_id = cpuid();
-  pop_off();
+  // 通过tp直接找到当前CPU的分配器（见kfree）
+  allocator = this_cpu_ptr(&cpu_allocator);
   
   // 首先尝试从当前CPU的空闲链表分配
-  acquire(&cpu_allocators[current_cpu_id].lock);
-  allocated_page = cpu_allocators[current_cpu_id].freelist;
+  acquire(&allocator->lock);
+  allocated_page = allocator->freelist;
   if(allocated_page)
-    cpu_allocators[current_cpu_id].freelist = allocated_page->next;
-  release(&cpu_allocators[current_cpu_id].lock);
+    allocator->freelist = allocated_page->next;
+  release(&allocator->lock);
   
   // 如果当前CPU没有空闲页面，尝试从其他CPU窃取
-  if(!allocated_page && (allocated_page = steal_pages_from_other_cpu(current_cpu_id))) {
-    acquire(&cpu_allocators[current_cpu_id].lock);
+  if(!allocated_page && (allocated_page = steal_pages_from_other_cpu(allocator->cpu_id))) {
+    acquire(&allocator->lock);
     // 将窃取的页面链表（除第一个页面外）添加到当前CPU的空闲链表
-    cpu_allocators[current_cpu_id].freelist = allocated_page->next;
-    release(&cpu_allocators[current_cpu_id].lock);
+    allocator->freelist = allocated_page->next;
+    release(&allocator->lock);
   }
 
+  // 所有CPU都没有空闲页面时，让缓存归还内存
+  // 归还的页面要等rcu宽限期结束才回到空闲链表，所以本次分配仍然失败，
+  // 之后的分配才能用上这些页面
+  if(!allocated_page)
+    shrink();
+
   if(allocated_page)
     memset((char*)allocated_page, 5, PGSIZE); // 填充垃圾数据用于调试
   return (void*)allocated_page;
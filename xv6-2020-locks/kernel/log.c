@@ -29,6 +29,20 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Committing a transaction only appends it to the log; the
+// blocks stay pinned and marked dirty in the buffer cache.
+// Committed transactions pile up in the log until the log
+// flusher, a kernel thread, installs them at their home
+// locations (a checkpoint): when the log is half full, when
+// the oldest has been there FLUSH_AGE ticks, when begin_op()
+// runs out of log space, or when sync() or fsync() asks.
+// The flusher copies each block from its log slot, not from
+// the buffer cache, which may hold newer uncommitted changes,
+// and writes the blocks sorted by block number, NSTAGE at a
+// time; runs of consecutive blocks go to the disk as single
+// requests, as does each transaction's append to the log.
+// A commit waits only while the flusher is installing.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,13 +57,26 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int installing;  // the flusher is installing ckpt.
+  int urgent;      // someone waits for the flusher.
   int dev;
-  struct logheader lh;
+  struct logheader lh;    // transaction being built.
+  struct logheader ckpt;  // committed, not yet installed; on disk.
+  struct buf *ckptbuf[LOGSIZE]; // cached home block for each ckpt.block.
+  uint ckpttime;   // ticks when ckpt became non-empty.
+  int commitgen;   // incremented by each commit.
+  int flushgen;    // incremented by each install.
+  void *flushchan; // what the flusher is sleeping on, if anything.
 };
 struct log log;
 
+#define FLUSH_AGE 10              // ticks a commit may wait to be installed.
+#define FLUSH_THRESHOLD (LOGSIZE/2)
+#define NSTAGE 16                 // blocks per install batch.
+
 static void recover_from_log(void);
 static void commit();
+static void logflusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -62,23 +89,75 @@ initlog(int dev, struct superblock *sb)
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  kthread("logflush", logflusher);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Used only by recovery; the flusher uses install_batch().
 static void
-install_trans(int recovering)
+install_trans(void)
 {
-  int tail;
+  struct buf *lbuf[NSTAGE];
+  int i, k, tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (i = 0; i < log.ckpt.n; i += NSTAGE) {
+    k = log.ckpt.n - i < NSTAGE ? log.ckpt.n - i : NSTAGE;
+    bread_range(log.dev, log.start+i+1, k, lbuf); // read log blocks
+    for (tail = 0; tail < k; tail++) {
+      // a block may be in the log more than once, so
+      // write each before reading the next.
+      struct buf *dbuf = bread(log.dev, log.ckpt.block[i+tail]); // read dst
+      memmove(dbuf->data, lbuf[tail]->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(lbuf[tail]);
+      brelse(dbuf);
+    }
+  }
+}
+
+// Copy the first n committed blocks from the log to their home
+// locations. Only the last copy of a block that was committed
+// more than once is written, and the writes go out in block
+// number order, NSTAGE at a time, through staging buffers
+// rather than the cached home blocks.
+static void
+install_batch(int n)
+{
+  static struct buf stage[NSTAGE];
+  struct buf *sb[NSTAGE];
+  int order[LOGSIZE];
+  int i, j, k, m, t, tail;
+  struct buf *lbuf;
+
+  // the latest slot for each block.
+  m = 0;
+  for (tail = n-1; tail >= 0; tail--) {
+    for (j = 0; j < m; j++)
+      if (log.ckpt.block[order[j]] == log.ckpt.block[tail])
+        break;
+    if (j == m)
+      order[m++] = tail;
+  }
+
+  // sort by home block number.
+  for (i = 1; i < m; i++) {
+    t = order[i];
+    for (j = i; j > 0 && log.ckpt.block[order[j-1]] > log.ckpt.block[t]; j--)
+      order[j] = order[j-1];
+    order[j] = t;
+  }
+
+  for (i = 0; i < m; i += NSTAGE) {
+    k = m - i < NSTAGE ? m - i : NSTAGE;
+    for (j = 0; j < k; j++) {
+      lbuf = bread(log.dev, log.start+order[i+j]+1);
+      memmove(stage[j].data, lbuf->data, BSIZE);
+      brelse(lbuf);
+      stage[j].dev = log.dev;
+      stage[j].blockno = log.ckpt.block[order[i+j]];
+      sb[j] = &stage[j];
+    }
+    virtio_disk_rw_vec(sb, k, 1);
   }
 }
 
@@ -89,9 +168,9 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.ckpt.n = lh->n;
+  for (i = 0; i < log.ckpt.n; i++) {
+    log.ckpt.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -105,9 +184,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.ckpt.n;
+  for (i = 0; i < log.ckpt.n; i++) {
+    hb->block[i] = log.ckpt.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,11 +196,105 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  install_trans(); // if committed, copy from log to disk
+  log.ckpt.n = 0;
   write_head(); // clear the log
 }
 
+// Wake the flusher, if it is asleep.
+// Caller must hold log.lock.
+static void
+flushwake(void)
+{
+  if(log.flushchan)
+    wakeup(log.flushchan);
+}
+
+// Should the flusher install ckpt now?
+static int
+flushdue(void)
+{
+  return log.ckpt.n > 0 &&
+    (log.urgent || log.ckpt.n >= FLUSH_THRESHOLD ||
+     ticks - log.ckpttime >= FLUSH_AGE);
+}
+
+// The log flusher kernel thread: installs committed
+// transactions at their home locations, so that
+// commit() need not wait for it.
+static void
+logflusher(void)
+{
+  int n, tail;
+  struct buf *b;
+
+  acquire(&log.lock);
+  for(;;){
+    if(!flushdue()){
+      // with nothing committed, wait for a commit;
+      // otherwise check the age again at each tick.
+      log.flushchan = log.ckpt.n == 0 ? (void*)&log.ckpt : (void*)&ticks;
+      sleep(log.flushchan, &log.lock);
+      log.flushchan = 0;
+      continue;
+    }
+    if(log.committing){
+      // commit() appends to ckpt; end_op() wakes &log.
+      log.flushchan = &log;
+      sleep(&log, &log.lock);
+      log.flushchan = 0;
+      continue;
+    }
+    log.installing = 1;
+    n = log.ckpt.n;
+    release(&log.lock);
+
+    install_batch(n);
+
+    acquire(&log.lock);
+    log.ckpt.n = 0;
+    release(&log.lock);
+    write_head();    // Erase the transactions from the log
+    // clear dirty before the last pin goes; bvictim()
+    // and bclaim() panic if they reclaim a dirty block.
+    for (tail = 0; tail < n; tail++) {
+      b = log.ckptbuf[tail];
+      b->dirty = 0;
+      bunpin(b);
+    }
+
+    acquire(&log.lock);
+    log.installing = 0;
+    log.urgent = 0;
+    log.flushgen++;
+    wakeup(&log);
+  }
+}
+
+// Wait until every transaction that committed, or was being
+// built, before the call has been installed at its home
+// location. The log is shared by all files, so fsync() uses
+// this too.
+void
+logsync(void)
+{
+  int gen;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0 || log.committing){
+    gen = log.commitgen;
+    while(log.commitgen == gen)
+      sleep(&log, &log.lock);
+  }
+  gen = log.flushgen;
+  while(log.flushgen == gen && (log.ckpt.n > 0 || log.committing)){
+    log.urgent = 1;
+    flushwake();
+    sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
@@ -130,8 +303,13 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.ckpt.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+      // this op might exhaust log space; wait for commit,
+      // or for the flusher to empty the log.
+      if(log.ckpt.n > 0){
+        log.urgent = 1;
+        flushwake();
+      }
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -169,36 +347,63 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.commitgen++;
     wakeup(&log);
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log, after the
+// transactions already in it. Marks the cached blocks
+// dirty and hands their pins over to ckpt.
 static void
 write_log(void)
 {
+  struct buf *to[LOGSIZE];
   int tail;
 
+  bread_range(log.dev, log.start+log.ckpt.n+1, log.lh.n, to); // log blocks
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
+    from->dirty = 1;
+    log.ckptbuf[log.ckpt.n+tail] = from;
     brelse(from);
-    brelse(to);
   }
+  bwrite_range(to, log.lh.n);  // write the log
+  for (tail = 0; tail < log.lh.n; tail++)
+    brelse(to[tail]);
 }
 
 static void
 commit()
 {
+  int i;
+
   if (log.lh.n > 0) {
+    acquire(&log.lock);
+    while(log.installing)
+      sleep(&log, &log.lock);
+    release(&log.lock);
+
     write_log();     // Write modified blocks from cache to log
+
+    acquire(&log.lock);
+    if(log.ckpt.n == 0)
+      log.ckpttime = ticks;
+    for (i = 0; i < log.lh.n; i++)
+      log.ckpt.block[log.ckpt.n+i] = log.lh.block[i];
+    log.ckpt.n += log.lh.n;
+    release(&log.lock);
+
     write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+
+    acquire(&log.lock);
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    // the first commit starts the flusher's clock.
+    if(log.flushchan == &log.ckpt || flushdue())
+      flushwake();
+    release(&log.lock);
   }
 }
 
@@ -216,7 +421,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n + log.ckpt.n >= LOGSIZE || log.lh.n + log.ckpt.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
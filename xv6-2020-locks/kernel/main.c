@@ -10,6 +10,7 @@ volatile static int started = 0;
 void
 main()
 {
+  percpuinithart();  // per-cpu data; cpuid() needs it
   if(cpuid() == 0){
     consoleinit();
 #if defined(LAB_PGTBL) || defined(LAB_LOCK)
@@ -23,6 +24,7 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    rcuinit();       // read-copy-update
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
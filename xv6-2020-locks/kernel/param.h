@@ -8,6 +8,9 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#ifndef BCACHEFRAC
+#define BCACHEFRAC   8  // disk block cache grows to at most 1/BCACHEFRAC of memory
+#endif
 #define FSSIZE       10000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
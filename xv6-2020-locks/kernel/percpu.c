@@ -0,0 +1,32 @@
+// Per-cpu data area; see percpu.h.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "percpu.h"
+#include "defs.h"
+
+static DEFINE_PERCPU(int, hartid);
+
+// Point this hart's tp at its copy of the per-cpu area.
+// Called first thing in main(), while tp still holds the
+// hartid that start() put there.
+void
+percpuinithart(void)
+{
+  uint64 id = r_tp();
+
+  if(id >= NCPU || percpu_start + NCPU * (percpu_end - percpu_start) > percpu_limit)
+    panic("percpuinithart");
+  *per_cpu_ptr(&hartid, id) = id;
+  w_tp((uint64)per_cpu_ptr(&percpu_start[0], id));
+}
+
+// This hart's number. Must be called with interrupts
+// disabled, to prevent race with process being moved
+// to a different CPU.
+int
+cpuid()
+{
+  return this_cpu_read(&hartid);
+}
@@ -0,0 +1,46 @@
+// Per-cpu variables.
+//
+// DEFINE_PERCPU(type, name) puts name in the .percpu section.
+// kernel.ld reserves NCPU copies of that section one after the
+// other, each starting on a cache line, so no two harts' copies
+// share a line. In the kernel, each hart's tp register holds
+// the address of its own copy (see percpuinithart()), so
+// this_cpu_ptr() is a subtraction and an addition. Like .bss,
+// the copies start zeroed; per-cpu variables cannot have
+// initializers. Only use per-cpu variables through the macros
+// below: the name itself is hart 0's copy.
+//
+// Needs riscv.h.
+
+#define CACHELINE 64
+
+#define DEFINE_PERCPU(type, name) \
+  __attribute__((section(".percpu"))) type name
+
+extern char percpu_start[], percpu_end[], percpu_limit[];
+
+// Address of this hart's copy of the per-cpu variable *p.
+// Only stays this hart's if the caller cannot move to another
+// hart, e.g. with interrupts off; a caller that only uses it
+// under a lock kept in the variable does not care.
+#define this_cpu_ptr(p) \
+  ((typeof(p))((char*)(p) - percpu_start + r_tp()))
+
+// Address of hart id's copy of the per-cpu variable *p.
+#define per_cpu_ptr(p, id) \
+  ((typeof(p))((char*)(p) + (uint64)(id) * (percpu_end - percpu_start)))
+
+#define this_cpu_read(p) (*this_cpu_ptr(p))
+
+// Add n to this hart's copy of the per-cpu counter *p.
+// Interrupts are off across the read-modify-write, so that
+// it needs no atomic instruction.
+#define this_cpu_add(p, n) do {     \
+    int _intr = intr_get();         \
+    intr_off();                     \
+    *this_cpu_ptr(p) += (n);        \
+    if(_intr)                       \
+      intr_on();                    \
+  } while(0)
+
+#define this_cpu_inc(p) this_cpu_add(p, 1)
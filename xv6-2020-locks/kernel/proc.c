@@ -4,9 +4,10 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "percpu.h"
 #include "defs.h"
 
-struct cpu cpus[NCPU];
+DEFINE_PERCPU(struct cpu, cpus);
 
 struct proc proc[NPROC];
 
@@ -44,23 +45,11 @@ procinit(void)
   kvminithart();
 }
 
-// Must be called with interrupts disabled,
-// to prevent race with process being moved
-// to a different CPU.
-int
-cpuid()
-{
-  int id = r_tp();
-  return id;
-}
-
 // Return this CPU's cpu struct.
 // Interrupts must be disabled.
 struct cpu*
 mycpu(void) {
-  int id = cpuid();
-  struct cpu *c = &cpus[id];
-  return c;
+  return this_cpu_ptr(&cpus);
 }
 
 // Return the current struct proc *, or zero if none.
@@ -463,6 +452,9 @@ scheduler(void)
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
+
+    // No locks are held, so run rcu callbacks that are due.
+    rcupoll();
     
     int nproc = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
@@ -481,6 +473,7 @@ scheduler(void)
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
+        rcuqs();
       }
       release(&p->lock);
     }
@@ -529,6 +522,35 @@ yield(void)
   release(&p->lock);
 }
 
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kthreadstart.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfunc();
+  panic("kthread returned");
+}
+
+// Start a process that runs fn in the kernel and never
+// returns to user space. fn must not return.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->kfunc = fn;
+  p->context.ra = (uint64)kthreadstart;
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
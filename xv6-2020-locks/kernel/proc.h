@@ -24,9 +24,11 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct mcsnode mcs;         // This cpu's place in an MCS lock's queue.
+  uint64 rcuqs;               // Quiescent states passed, for rcu.c.
 };
 
-extern struct cpu cpus[NCPU];
+extern struct cpu cpus;  // per-cpu; use mycpu() or per_cpu_ptr()
 
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
@@ -103,4 +105,5 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfunc)(void);         // kernel thread body; see kthread()
 };
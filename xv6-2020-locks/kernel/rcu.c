@@ -0,0 +1,123 @@
+// Read-copy-update, based on quiescent states.
+//
+// A reader brackets its use of RCU-protected data with
+// rcu_read_lock() and rcu_read_unlock(), which only turn
+// interrupts off, so it cannot be switched out, and it must
+// not sleep in between. A cpu that has come back to
+// scheduler() since some moment therefore cannot still be
+// using anything it found before then. scheduler() counts
+// these quiescent states in c->rcuqs.
+//
+// An updater unlinks an object so that new readers cannot
+// find it, then hands it to call_rcu(). Once every cpu has
+// passed a quiescent state (a grace period), no reader can
+// still hold it, and rcupoll() runs the callback to free it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "percpu.h"
+#include "rcu.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  struct rcuhead *next;  // callbacks for the next grace period
+  struct rcuhead *wait;  // callbacks for the current grace period
+  uint64 snap[NCPU];     // each cpu's rcuqs when it began
+} rcu;
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+}
+
+void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// Arrange for h->func(h) to be called once no reader
+// can hold a reference found before now.
+void
+call_rcu(struct rcuhead *h, void (*func)(struct rcuhead*))
+{
+  h->func = func;
+  acquire(&rcu.lock);
+  h->next = rcu.next;
+  rcu.next = h;
+  release(&rcu.lock);
+}
+
+// Note a quiescent state: this cpu is in scheduler(),
+// outside any read-side critical section.
+void
+rcuqs(void)
+{
+  struct cpu *c = mycpu();
+
+  __sync_synchronize();
+  __atomic_store_n(&c->rcuqs, c->rcuqs + 1, __ATOMIC_RELAXED);
+}
+
+// Has every cpu passed a quiescent state since the
+// current grace period began? A cpu whose count was 0
+// had not started scheduling, so it held nothing.
+static int
+gpdone(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    if(rcu.snap[i] != 0 &&
+       __atomic_load_n(&per_cpu_ptr(&cpus, i)->rcuqs, __ATOMIC_RELAXED) == rcu.snap[i])
+      return 0;
+  return 1;
+}
+
+// Note a quiescent state, end the current grace period if
+// every cpu has passed one, and start the next if callbacks
+// are waiting for it. Then run the callbacks whose grace
+// period has ended. Called by scheduler() with no locks held.
+void
+rcupoll(void)
+{
+  struct rcuhead *done, *h;
+  int i;
+
+  rcuqs();
+  if(__atomic_load_n(&rcu.wait, __ATOMIC_RELAXED) == 0 &&
+     __atomic_load_n(&rcu.next, __ATOMIC_RELAXED) == 0)
+    return;
+
+  done = 0;
+  acquire(&rcu.lock);
+  if(rcu.wait && gpdone()){
+    done = rcu.wait;
+    rcu.wait = 0;
+  }
+  if(rcu.wait == 0 && rcu.next){
+    rcu.wait = rcu.next;
+    rcu.next = 0;
+    for(i = 0; i < NCPU; i++)
+      rcu.snap[i] = __atomic_load_n(&per_cpu_ptr(&cpus, i)->rcuqs, __ATOMIC_RELAXED);
+  }
+  release(&rcu.lock);
+
+  while(done){
+    h = done;
+    done = h->next;
+    h->func(h);
+  }
+}
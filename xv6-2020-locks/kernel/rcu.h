@@ -0,0 +1,6 @@
+// A callback queued by call_rcu(), usually embedded
+// in the object that it frees.
+struct rcuhead {
+  struct rcuhead *next;
+  void (*func)(struct rcuhead*);
+};
@@ -288,7 +288,9 @@ r_sp()
 }
 
 // read and write tp, the thread pointer, which holds
-// this core's hartid (core number), the index into cpus[].
+// this core's hartid (core number) until main() calls
+// percpuinithart(), and then the address of this core's
+// per-cpu area.
 static inline uint64
 r_tp()
 {
@@ -0,0 +1,132 @@
+// Read-mostly locks: reader-writer spin locks and sequence locks.
+//
+// Both keep a spinlock for writers, so each shows up in the
+// statistics device under its name. For an rwlock, #acquire()
+// counts readers and writers and #fetch-and-add counts spins by
+// either. For a seqlock, #acquire() counts writes and
+// #fetch-and-add counts reads that had to retry.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  initlock(&rw->lk, name);
+  rw->readers = 0;
+}
+
+// Acquire rw for reading. Any number of cpus may hold
+// it for reading at once, but not while a writer holds it.
+void
+acquireread(struct rwlock *rw)
+{
+  uint r;
+
+  push_off(); // disable interrupts to avoid deadlock.
+#ifdef LAB_LOCK
+  lockcount(&rw->lk, 1, 0);
+#endif
+  for(;;){
+    r = __atomic_load_n(&rw->readers, __ATOMIC_RELAXED);
+    if((r & RW_WRITER) == 0 &&
+       __sync_bool_compare_and_swap(&rw->readers, r, r + 1))
+      break;
+    SPIN(&rw->lk);
+  }
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  if((rw->readers & ~RW_WRITER) == 0)
+    panic("releaseread");
+  __sync_fetch_and_sub(&rw->readers, 1);
+  pop_off();
+}
+
+// Acquire rw for writing. Keeps out new readers at once,
+// then waits for the current ones to leave, so a stream
+// of readers cannot starve a writer.
+void
+acquirewrite(struct rwlock *rw)
+{
+  acquire(&rw->lk);
+  __sync_fetch_and_or(&rw->readers, RW_WRITER);
+  while(__atomic_load_n(&rw->readers, __ATOMIC_ACQUIRE) != RW_WRITER)
+    SPIN(&rw->lk);
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  __sync_fetch_and_and(&rw->readers, ~RW_WRITER);
+  release(&rw->lk);
+}
+
+// Check whether this cpu holds rw for writing.
+int
+holdingwrite(struct rwlock *rw)
+{
+  return holding(&rw->lk);
+}
+
+void
+initseqlock(struct seqlock *sl, char *name)
+{
+  initlock(&sl->lk, name);
+  sl->seq = 0;
+}
+
+// Begin a write. Writers exclude each other but not readers.
+void
+acquireseq(struct seqlock *sl)
+{
+  acquire(&sl->lk);
+  sl->seq++;
+  __sync_synchronize();
+}
+
+void
+releaseseq(struct seqlock *sl)
+{
+  __sync_synchronize();
+  sl->seq++;
+  release(&sl->lk);
+}
+
+// Begin a read. Returns the sequence number to pass to
+// readseqretry() once the protected data has been read:
+//   do {
+//     s = readseqbegin(sl);
+//     ... read ...
+//   } while(readseqretry(sl, s));
+uint
+readseqbegin(struct seqlock *sl)
+{
+  uint s;
+
+  while((s = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+    SPIN(&sl->lk);
+  __sync_synchronize();
+  return s;
+}
+
+// Returns 1 if a write happened since readseqbegin()
+// returned s, so that what was read may be inconsistent.
+int
+readseqretry(struct seqlock *sl, uint s)
+{
+  __sync_synchronize();
+  if(__atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != s){
+    SPIN(&sl->lk);
+    return 1;
+  }
+  return 0;
+}
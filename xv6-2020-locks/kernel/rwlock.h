@@ -0,0 +1,16 @@
+// Reader-writer spin lock.
+struct rwlock {
+  uint readers;       // Number of readers, plus RW_WRITER.
+  struct spinlock lk; // Serializes writers.
+};
+
+// Set in readers while a writer holds the lock, or waits for
+// the readers to leave; no new readers may enter.
+#define RW_WRITER 0x80000000
+
+// Sequence lock: readers never block the writer, but retry
+// if a write happened while they were reading.
+struct seqlock {
+  uint seq;           // Odd while a write is in progress.
+  struct spinlock lk; // Serializes writers.
+};
@@ -15,17 +15,43 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
 }
 
+// Is lk held by owner, and is owner running on a cpu?
+// Reads without locks: the answer is only a hint.
+static int
+ownerrunning(struct sleeplock *lk, struct proc *owner)
+{
+  return __atomic_load_n(&lk->locked, __ATOMIC_RELAXED) &&
+         __atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == owner &&
+         __atomic_load_n(&owner->state, __ATOMIC_RELAXED) == RUNNING;
+}
+
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *owner;
+
   acquire(&lk->lk);
   while (lk->locked) {
+    // A holder that is running on another cpu will probably
+    // release lk sooner than a sleep and wakeup would take,
+    // so spin until it releases lk or stops running; sleep
+    // only if it is itself asleep or waiting for a cpu.
+    owner = lk->owner;
+    if(owner && owner->state == RUNNING){
+      release(&lk->lk);
+      while(ownerrunning(lk, owner))
+        ;
+      acquire(&lk->lk);
+      continue;
+    }
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -35,6 +61,7 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
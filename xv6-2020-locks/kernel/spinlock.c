@@ -1,10 +1,15 @@
 // Mutual exclusion spin locks.
+//
+// A lock is one of three types, chosen when it is initialized:
+// test-and-set (initlock()), ticket or MCS (initlocktype()).
+// All three share the acquire()/release() interface.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "percpu.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -14,6 +19,14 @@
 static struct spinlock *locks[NLOCK];
 struct spinlock lock_locks;
 
+// Each cpu counts acquires of, and spins waiting for, the lock
+// in locks[i] in its own lockcounts[i], with plain increments.
+struct lockcount {
+  int n;                // #acquire()
+  int nts;              // #fetch-and-add
+};
+static DEFINE_PERCPU(struct lockcount, lockcounts[NLOCK]);
+
 void
 freelock(struct spinlock *lk)
 {
@@ -25,37 +38,265 @@ freelock(struct spinlock *lk)
       break;
     }
   }
+  lk->slot = 0;
   release(&lock_locks);
 }
 
 static void
 findslot(struct spinlock *lk) {
   acquire(&lock_locks);
-  int i;
+  int i, c;
   for (i = 0; i < NLOCK; i++) {
     if(locks[i] == 0) {
       locks[i] = lk;
+      for (c = 0; c < NCPU; c++) {
+        per_cpu_ptr(&lockcounts[i], c)->n = 0;
+        per_cpu_ptr(&lockcounts[i], c)->nts = 0;
+      }
+      lk->slot = i + 1;
       release(&lock_locks);
       return;
     }
   }
-  panic("findslot");
+  // The registry is full (the buffer cache can grow to
+  // thousands of sleeplocks); leave lk untracked.
+  lk->slot = 0;
+  release(&lock_locks);
+}
+
+// Count n acquires of lk and nts spins waiting for it,
+// on this cpu.
+void
+lockcount(struct spinlock *lk, int n, int nts)
+{
+  if(lk->slot == 0)
+    return;
+  this_cpu_add(&lockcounts[lk->slot-1].n, n);
+  this_cpu_add(&lockcounts[lk->slot-1].nts, nts);
+}
+
+// Sum lk's counts over all cpus.
+static void
+locktotals(struct spinlock *lk, int *n, int *nts)
+{
+  int c;
+
+  *n = *nts = 0;
+  if(lk->slot == 0)
+    return;
+  for(c = 0; c < NCPU; c++){
+    *n += per_cpu_ptr(&lockcounts[lk->slot-1], c)->n;
+    *nts += per_cpu_ptr(&lockcounts[lk->slot-1], c)->nts;
+  }
+}
+
+static int
+ntas(struct spinlock *lk)
+{
+  int n, nts;
+
+  locktotals(lk, &n, &nts);
+  return nts;
+}
+
+// Lock profile: for each lock name and call site of acquire(),
+// log2 histograms of the time spent waiting for the lock and
+// holding it, in time CSR units. Each cpu records into its own
+// table, with interrupts off since it holds the lock, so no
+// atomic instructions are needed. statsprof() dumps the tables
+// through the statistics device; user/lockstat merges and sorts.
+#define NPROFSITE 256   // (name, call site) pairs per cpu
+#define NPROFHIST 16    // bucket i counts times in [2^i, 2^(i+1))
+
+struct lockprof {
+  char *name;           // lock name, or 0 if unused
+  uint64 pc;            // return address of acquire()
+  uint n;
+  uint64 wait;          // total wait time
+  uint64 hold;          // total hold time
+  uint whist[NPROFHIST];
+  uint hhist[NPROFHIST];
+};
+
+struct lockprofs {
+  struct lockprof site[NPROFSITE];
+  int gen;              // clear site[] when this falls behind profgen
+};
+static DEFINE_PERCPU(struct lockprofs, lockprofs);
+
+static int profgen;
+
+static int
+profbucket(uint64 t)
+{
+  int i;
+
+  for(i = 0; t > 1 && i < NPROFHIST-1; i++)
+    t >>= 1;
+  return i;
+}
+
+// Record a release of lk, after holding it for hold.
+// Called with lk held, so interrupts are off.
+static void
+lockprof(struct spinlock *lk, uint64 hold)
+{
+  struct lockprofs *t = this_cpu_ptr(&lockprofs);
+  struct lockprof *s;
+  int i, h;
+
+  if(t->gen != profgen){
+    memset(t->site, 0, sizeof(t->site));
+    t->gen = profgen;
+  }
+
+  h = (((uint64)lk->name ^ lk->pc) >> 2) % NPROFSITE;
+  for(i = 0; i < NPROFSITE; i++){
+    s = &t->site[(h + i) % NPROFSITE];
+    if(s->name == 0){
+      s->name = lk->name;
+      s->pc = lk->pc;
+    }
+    if(s->name == lk->name && s->pc == lk->pc){
+      s->n++;
+      s->wait += lk->twait;
+      s->hold += hold;
+      s->whist[profbucket(lk->twait)]++;
+      s->hhist[profbucket(hold)]++;
+      return;
+    }
+  }
+  // the table is full; drop the record.
+}
+
+// Start a new profile: each cpu clears its table the
+// next time it records into it.
+void
+lockprofreset(void)
+{
+  __atomic_store_n(&profgen, profgen + 1, __ATOMIC_RELEASE);
+}
+
+// Format the profile, one line per cpu and site, starting at
+// record *next, into buf; stop before a line that does not fit.
+// Each line is: call site (as an offset from KERNBASE, in hex),
+// acquires, total wait and hold in microseconds, the NPROFHIST
+// wait histogram buckets, the hold buckets, then the lock name.
+// Returns the number of bytes written, 0 at the end.
+int
+statsprof(char *buf, int sz, int *next)
+{
+  char line[512];
+  struct lockprofs *t;
+  struct lockprof *s;
+  int n, m, i, k;
+
+  n = 0;
+  for(; *next < NCPU*NPROFSITE; (*next)++){
+    t = per_cpu_ptr(&lockprofs, *next / NPROFSITE);
+    if(t->gen != profgen)
+      continue;
+    s = &t->site[*next % NPROFSITE];
+    if(s->name == 0 || s->n == 0)
+      continue;
+    m = snprintf(line, sizeof(line), "%x %d %d %d", (int)(s->pc - KERNBASE),
+                 s->n, (int)(s->wait / 10), (int)(s->hold / 10));
+    for(k = 0; k < NPROFHIST; k++)
+      m += snprintf(line+m, sizeof(line)-m, " %d", s->whist[k]);
+    for(k = 0; k < NPROFHIST; k++)
+      m += snprintf(line+m, sizeof(line)-m, " %d", s->hhist[k]);
+    m += snprintf(line+m, sizeof(line)-m, " %s\n", s->name);
+    if(n + m > sz)
+      break;
+    for(i = 0; i < m; i++)
+      buf[n+i] = line[i];
+    n += m;
+  }
+  return n;
 }
 #endif
 
 void
 initlock(struct spinlock *lk, char *name)
+{
+  initlocktype(lk, name, SPIN_TAS);
+}
+
+void
+initlocktype(struct spinlock *lk, char *name, int type)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->type = type;
+  lk->next = 0;
+  lk->owner = 0;
+  lk->tail = 0;
   lk->cpu = 0;
 #ifdef LAB_LOCK
-  lk->nts = 0;
-  lk->n = 0;
   findslot(lk);
 #endif  
 }
 
+static void
+tasacquire(struct spinlock *lk)
+{
+  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  //   a5 = 1
+  //   s1 = &lk->locked
+  //   amoswap.w.aq a5, a5, (s1)
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    SPIN(lk);
+}
+
+// Take the next ticket and wait until it is served,
+// so that cpus get the lock in the order they asked.
+static void
+ticketacquire(struct spinlock *lk)
+{
+  uint t;
+
+  t = __sync_fetch_and_add(&lk->next, 1);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != t)
+    SPIN(lk);
+  lk->locked = 1;
+}
+
+// If no one holds or waits for lk, take it at once.
+// Otherwise join the queue of waiters, each spinning on its
+// own cpu's node until the one before it hands over the
+// head of the queue; only the head spins on lk itself.
+static void
+mcsacquire(struct spinlock *lk)
+{
+  struct mcsnode *n, *prev, *next;
+
+  if(__atomic_load_n(&lk->tail, __ATOMIC_RELAXED) == 0 &&
+     __sync_bool_compare_and_swap(&lk->locked, 0, 1))
+    return;
+
+  n = &mycpu()->mcs;
+  n->next = 0;
+  n->wait = 1;
+  prev = __atomic_exchange_n(&lk->tail, n, __ATOMIC_ACQ_REL);
+  if(prev){
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+    while(__atomic_load_n(&n->wait, __ATOMIC_ACQUIRE))
+      SPIN(lk);
+  }
+
+  // at the head of the queue.
+  while(__atomic_load_n(&lk->locked, __ATOMIC_RELAXED) ||
+        !__sync_bool_compare_and_swap(&lk->locked, 0, 1))
+    SPIN(lk);
+
+  // leave the queue, making the next waiter the head.
+  if(!__sync_bool_compare_and_swap(&lk->tail, n, 0)){
+    while((next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) == 0)
+      ;
+    __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+  }
+}
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void
@@ -66,19 +307,20 @@ acquire(struct spinlock *lk)
     panic("acquire");
 
 #ifdef LAB_LOCK
-    __sync_fetch_and_add(&(lk->n), 1);
+  uint64 t0 = r_time();
+  lockcount(lk, 1, 0);
 #endif      
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
-#ifdef LAB_LOCK
-    __sync_fetch_and_add(&(lk->nts), 1);
-#else
-   ;
-#endif
+  switch(lk->type){
+  case SPIN_TICKET:
+    ticketacquire(lk);
+    break;
+  case SPIN_MCS:
+    mcsacquire(lk);
+    break;
+  default:
+    tasacquire(lk);
+    break;
   }
 
   // Tell the C compiler and the processor to not move loads or stores
@@ -89,6 +331,11 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+#ifdef LAB_LOCK
+  lk->pc = (uint64)__builtin_return_address(0);
+  lk->tacq = r_time();
+  lk->twait = lk->tacq - t0;
+#endif
 }
 
 // Release the lock.
@@ -98,6 +345,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LAB_LOCK
+  lockprof(lk, r_time() - lk->tacq);
+#endif
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -108,14 +359,20 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  if(lk->type == SPIN_TICKET){
+    // serve the next ticket.
+    lk->locked = 0;
+    __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+  } else {
+    // Release the lock, equivalent to lk->locked = 0.
+    // This code doesn't use a C assignment, since the C standard
+    // implies that an assignment might be implemented with
+    // multiple store instructions.
+    // On RISC-V, sync_lock_release turns into an atomic swap:
+    //   s1 = &lk->locked
+    //   amoswap.w zero, zero, (s1)
+    __sync_lock_release(&lk->locked);
+  }
 
   pop_off();
 }
@@ -158,35 +415,118 @@ pop_off(void)
     intr_on();
 }
 
+// A lock of each type, for lockbench().
+static struct spinlock benchlocks[] = {
+  [SPIN_TAS]    { .type = SPIN_TAS, .name = "bench.tas" },
+  [SPIN_TICKET] { .type = SPIN_TICKET, .name = "bench.ticket" },
+  [SPIN_MCS]    { .type = SPIN_MCS, .name = "bench.mcs" },
+};
+static volatile uint64 benchcount;
+
+// Acquire and release the benchmark lock of the given type
+// n times, with a short critical section. Store the elapsed
+// time and the longest wait for the lock, both in time CSR
+// units, in times[0] and times[1].
+// Returns -1 if type is not a lock type.
+int
+lockbench(int type, int n, uint64 *times)
+{
+  struct spinlock *lk;
+  uint64 start, t0, t;
+  int i, j;
+
+  if(type < 0 || type >= NELEM(benchlocks))
+    return -1;
+  lk = &benchlocks[type];
+
+  times[1] = 0;
+  start = r_time();
+  for(i = 0; i < n; i++){
+    // keep interrupts off from the first timestamp to the
+    // second, so that only waiting for lk is measured.
+    push_off();
+    t0 = r_time();
+    acquire(lk);
+    t = r_time() - t0;
+    for(j = 0; j < 10; j++)
+      benchcount++;
+    release(lk);
+    pop_off();
+    if(t > times[1])
+      times[1] = t;
+  }
+  times[0] = r_time() - start;
+  return 0;
+}
+
 #ifdef LAB_LOCK
 int
 snprint_lock(char *buf, int sz, struct spinlock *lk)
 {
-  int n = 0;
-  if(lk->n > 0) {
+  int n = 0, acq, nts;
+
+  locktotals(lk, &acq, &nts);
+  if(acq > 0) {
     n = snprintf(buf, sz, "lock: %s: #fetch-and-add %d #acquire() %d\n",
-                 lk->name, lk->nts, lk->n);
+                 lk->name, nts, acq);
   }
   return n;
 }
 
+// Like snprint_lock(locks[i]), but print one line for all
+// the locks named like locks[i], on behalf of the first of
+// them. The buffer cache has a lock per hash bucket and per
+// buffer; a line for each would not fit in the stats buffer.
+static int
+snprint_locks(char *buf, int sz, int i)
+{
+  int j, n, nts, acq = 0, tas = 0;
+  char *name = locks[i]->name;
+
+  for(j = 0; j < i; j++)
+    if(locks[j] && strncmp(locks[j]->name, name, 32) == 0)
+      return 0;
+  for(j = i; j < NLOCK; j++){
+    if(locks[j] && strncmp(locks[j]->name, name, 32) == 0){
+      locktotals(locks[j], &n, &nts);
+      acq += n;
+      tas += nts;
+    }
+  }
+  if(acq == 0)
+    return 0;
+  return snprintf(buf, sz, "lock: %s: #fetch-and-add %d #acquire() %d\n",
+                  name, tas, acq);
+}
+
 int
 statslock(char *buf, int sz) {
   int n;
   int tot = 0;
+  int hits, misses;
 
   acquire(&lock_locks);
   n = snprintf(buf, sz, "--- lock kmem/bcache stats\n");
   for(int i = 0; i < NLOCK; i++) {
+    // freelock() leaves holes.
     if(locks[i] == 0)
-      break;
+      continue;
     if(strncmp(locks[i]->name, "bcache", strlen("bcache")) == 0 ||
        strncmp(locks[i]->name, "kmem", strlen("kmem")) == 0) {
-      tot += locks[i]->nts;
-      n += snprint_lock(buf +n, sz-n, locks[i]);
+      tot += ntas(locks[i]);
+      n += snprint_locks(buf +n, sz-n, i);
     }
   }
   
+  n += snprintf(buf+n, sz-n, "--- lock icache/time stats\n");
+  for(int i = 0; i < NLOCK; i++) {
+    if(locks[i] == 0)
+      continue;
+    if(strncmp(locks[i]->name, "icache", strlen("icache")) == 0 ||
+       strncmp(locks[i]->name, "time", strlen("time")) == 0)
+      n += snprint_locks(buf +n, sz-n, i);
+  }
+
   n += snprintf(buf+n, sz-n, "--- top 5 contended locks:\n");
   int last = 100000000;
   // stupid way to compute top 5 contended locks
@@ -194,15 +534,19 @@ statslock(char *buf, int sz) {
     int top = 0;
     for(int i = 0; i < NLOCK; i++) {
       if(locks[i] == 0)
-        break;
-      if(locks[i]->nts > locks[top]->nts && locks[i]->nts < last) {
+        continue;
+      if(ntas(locks[i]) > ntas(locks[top]) && ntas(locks[i]) < last) {
         top = i;
       }
     }
     n += snprint_lock(buf+n, sz-n, locks[top]);
-    last = locks[top]->nts;
+    last = ntas(locks[top]);
   }
   n += snprintf(buf+n, sz-n, "tot= %d\n", tot);
+  // after tot=, which kalloctest and bcachetest look for first.
+  bcachestat(&hits, &misses);
+  n += snprintf(buf+n, sz-n, "bcache: %d hits %d misses\n", hits, misses);
+  n += bhashstats(buf+n, sz-n);
   release(&lock_locks);  
   return n;
 }
@@ -1,13 +1,44 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  int type;          // SPIN_TAS, SPIN_TICKET or SPIN_MCS
+
+  // SPIN_TICKET:
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket of the holder.
+
+  // SPIN_MCS:
+  struct mcsnode *tail;  // Last waiter in the queue, or 0.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
 #ifdef LAB_LOCK
-  int nts;
-  int n;
+  int slot;          // 1 + index in the statistics registry, or 0.
+  uint64 pc;         // Where the holder called acquire().
+  uint64 tacq;       // time CSR when it got the lock.
+  uint64 twait;      // How long it waited for the lock.
 #endif
 };
 
+// Count a spin while waiting for lk, for the statistics device.
+#ifdef LAB_LOCK
+#define SPIN(lk) lockcount((lk), 0, 1)
+#else
+#define SPIN(lk)
+#endif
+
+// Lock types.
+#define SPIN_TAS     0   // test-and-set: cheapest, but unfair, and
+                         // every waiter spins on the same cache line.
+#define SPIN_TICKET  1   // FIFO, but waiters still share a cache line.
+#define SPIN_MCS     2   // test-and-set when free, otherwise FIFO, with
+                         // each waiter spinning on its own node.
+
+// A waiter's place in an MCS lock's queue. A cpu waits for
+// at most one lock at a time, with interrupts off, so each
+// cpu needs only one (see struct cpu).
+struct mcsnode {
+  struct mcsnode *next;  // Next waiter.
+  int wait;              // Set until the previous waiter leaves the queue.
+};
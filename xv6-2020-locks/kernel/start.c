@@ -41,7 +41,7 @@ start()
   // ask for clock interrupts.
   timerinit();
 
-  // keep each CPU's hartid in its tp register, for cpuid().
+  // keep each CPU's hartid in its tp register, for percpuinithart().
   int id = r_mhartid();
   w_tp(id);
 
@@ -15,14 +15,47 @@ static struct {
   char buf[BUFSZ];
   int sz;
   int off;
+#ifdef LAB_LOCK
+  int prof;   // dump the lock profile instead of statslock()?
+  int next;   // next profile record to format
+#endif
 } stats;
 
 int statscopyin(char*, int);
 int statslock(char*, int);
-  
+int statsprof(char*, int, int*);
+void lockprofreset(void);
+
+// Writing "prof" makes the next dump the lock profile
+// (see statsprof()); writing "zero" starts a new profile;
+// writing "drop" empties the buffer cache of unused blocks.
 int
 statswrite(int user_src, uint64 src, int n)
 {
+#ifdef LAB_LOCK
+  char cmd[8];
+
+  if(n <= 0 || n >= sizeof(cmd))
+    return -1;
+  if(either_copyin(cmd, user_src, src, n) == -1)
+    return -1;
+  cmd[n] = 0;
+  if(strncmp(cmd, "prof", 4) == 0){
+    acquire(&stats.lock);
+    stats.prof = 1;
+    stats.next = 0;
+    release(&stats.lock);
+    return n;
+  }
+  if(strncmp(cmd, "zero", 4) == 0){
+    lockprofreset();
+    return n;
+  }
+  if(strncmp(cmd, "drop", 4) == 0){
+    bdrop();
+    return n;
+  }
+#endif
   return -1;
 }
 
@@ -38,9 +71,19 @@ statsread(int user_dst, uint64 dst, int n)
     stats.sz = statscopyin(stats.buf, BUFSZ);
 #endif
 #ifdef LAB_LOCK
-    stats.sz = statslock(stats.buf, BUFSZ);
+    if(stats.prof)
+      stats.sz = statsprof(stats.buf, BUFSZ, &stats.next);
+    else
+      stats.sz = statslock(stats.buf, BUFSZ);
 #endif
   }
+#ifdef LAB_LOCK
+  // the profile may not fit in buf; format the rest.
+  if(stats.prof && stats.sz > 0 && stats.off == stats.sz){
+    stats.sz = statsprof(stats.buf, BUFSZ, &stats.next);
+    stats.off = 0;
+  }
+#endif
   m = stats.sz - stats.off;
 
   if (m > 0) {
@@ -53,6 +96,9 @@ statsread(int user_dst, uint64 dst, int n)
     m = -1;
     stats.sz = 0;
     stats.off = 0;
+#ifdef LAB_LOCK
+    stats.prof = 0;
+#endif
   }
   release(&stats.lock);
   return m;
@@ -115,6 +115,28 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until the file system's committed changes
+// have reached their home locations on disk.
+uint64
+sys_sync(void)
+{
+  logsync();
+  return 0;
+}
+
+// All files share one log, so fsync(fd) is sync()
+// once fd has been checked.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  logsync();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 
 uint64
@@ -60,16 +61,18 @@ sys_sleep(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
+  // clockintr() holds tickslock.lk while it updates ticks,
+  // so holding it here means no wakeup can be missed.
+  acquire(&tickslock.lk);
   ticks0 = ticks;
   while(ticks - ticks0 < n){
     if(myproc()->killed){
-      release(&tickslock);
+      release(&tickslock.lk);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&ticks, &tickslock.lk);
   }
-  release(&tickslock);
+  release(&tickslock.lk);
   return 0;
 }
 
@@ -83,15 +86,32 @@ sys_kill(void)
   return kill(pid);
 }
 
+// run the kernel lock benchmark; see lockbench() in spinlock.c.
+uint64
+sys_lockbench(void)
+{
+  int type, n;
+  uint64 addr, times[2];
+
+  if(argint(0, &type) < 0 || argint(1, &n) < 0 || argaddr(2, &addr) < 0)
+    return -1;
+  if(lockbench(type, n, times) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char *)times, sizeof(times)) < 0)
+    return -1;
+  return 0;
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  uint xticks, s;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
+  do {
+    s = readseqbegin(&tickslock);
+    xticks = ticks;
+  } while(readseqretry(&tickslock, s));
   return xticks;
 }
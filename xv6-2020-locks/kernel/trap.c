@@ -3,10 +3,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
+struct seqlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
@@ -19,7 +20,7 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initseqlock(&tickslock, "time");
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -104,7 +105,7 @@ usertrapret(void)
   p->trapframe->kernel_satp = r_satp();         // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
-  p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
+  p->trapframe->kernel_hartid = r_tp();         // per-cpu area, for cpuid()
 
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
@@ -162,10 +163,10 @@ kerneltrap()
 void
 clockintr()
 {
-  acquire(&tickslock);
+  acquireseq(&tickslock);
   ticks++;
   wakeup(&ticks);
-  release(&tickslock);
+  releaseseq(&tickslock);
 }
 
 // check if it's an external interrupt or software interrupt,
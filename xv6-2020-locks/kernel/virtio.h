@@ -43,9 +43,12 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// at most this many virtio descriptors; the driver uses
+// less if the device's queue is shorter.
+// must be a power of two. with indirect descriptors each
+// request takes one, so this many can be in flight.
+// the rings must fit in the driver's two pages.
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -56,6 +59,7 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr points to a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
@@ -72,8 +76,10 @@ struct virtq_used_elem {
   uint32 len;
 };
 
+#define VRING_USED_F_NO_NOTIFY 1 // device needs no QUEUE_NOTIFY now
+
 struct virtq_used {
-  uint16 flags; // always zero
+  uint16 flags; // VRING_USED_F_NO_NOTIFY or zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
 };
@@ -20,6 +20,10 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// the most blocks in one request. each takes a descriptor,
+// as do the request header and the status byte.
+#define MAXSEG 16
+
 static struct disk {
   // the virtio driver and device mostly communicate through a set of
   // structures in RAM. pages[] allocates that memory. pages[] is a
@@ -34,40 +38,48 @@ static struct disk {
   
   // the first region of pages[] is a set (not a ring) of DMA
   // descriptors, with which the driver tells the device where to read
-  // and write individual disk operations. there are NUM descriptors.
-  // most commands consist of a "chain" (a linked list) of a couple of
-  // these descriptors.
+  // and write individual disk operations. there are num descriptors.
+  // if the device supports indirect descriptors, each command is one
+  // descriptor pointing to a table in tables[]; otherwise it is a
+  // "chain" (a linked list) of a couple of these descriptors.
   // points into pages[].
   struct virtq_desc *desc;
 
   // next is a ring in which the driver writes descriptor numbers
   // that the driver would like the device to process.  it only
   // includes the head descriptor of each chain. the ring has
-  // NUM elements.
+  // num elements.
   // points into pages[].
   struct virtq_avail *avail;
 
   // finally a ring in which the device writes descriptor numbers that
   // the device has finished processing (just the head of each chain).
-  // there are NUM used ring entries.
+  // there are num used ring entries.
   // points into pages[].
   struct virtq_used *used;
 
   // our own book-keeping.
+  int num;         // queue size agreed with the device, at most NUM.
+  int indirect;    // does the device take VRING_DESC_F_INDIRECT?
   char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 used_idx; // we've looked this far in used[2..num].
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXSEG];  // the blocks, in order.
+    int n;
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+
+  // descriptor tables for indirect commands,
+  // indexed by the command's ring descriptor.
+  struct virtq_desc tables[NUM][MAXSEG+2];
   
   struct spinlock vdisk_lock;
   
@@ -101,8 +113,8 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.indirect = (features >> VIRTIO_RING_F_INDIRECT_DESC) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -119,9 +131,12 @@ virtio_disk_init(void)
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
-  if(max < NUM)
+  // the largest power of two no bigger than NUM or max.
+  for(disk.num = NUM; disk.num > max; disk.num /= 2)
+    ;
+  if(disk.num < MAXSEG+2)
     panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
   memset(disk.pages, 0, sizeof(disk.pages));
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
@@ -130,11 +145,11 @@ virtio_disk_init(void)
   // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
   disk.desc = (struct virtq_desc *) disk.pages;
-  disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
+  disk.avail = (struct virtq_avail *)(disk.pages + disk.num*sizeof(struct virtq_desc));
   disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
+  // all num descriptors start out unused.
+  for(int i = 0; i < disk.num; i++)
     disk.free[i] = 1;
 
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
@@ -144,7 +159,7 @@ virtio_disk_init(void)
 static int
 alloc_desc()
 {
-  for(int i = 0; i < NUM; i++){
+  for(int i = 0; i < disk.num; i++){
     if(disk.free[i]){
       disk.free[i] = 0;
       return i;
@@ -157,7 +172,7 @@ alloc_desc()
 static void
 free_desc(int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("free_desc 1");
   if(disk.free[i])
     panic("free_desc 2");
@@ -184,12 +199,18 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// how many ring descriptors a transfer of k blocks uses.
 static int
-alloc3_desc(int *idx)
+ndesc(int k)
 {
-  for(int i = 0; i < 3; i++){
+  return disk.indirect ? 1 : k+2;
+}
+
+// allocate n descriptors (they need not be contiguous).
+static int
+alloc_descs(int *idx, int n)
+{
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,30 +221,51 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// how many of bufs[0..n) fit in one request:
+// a run of consecutive blocks, at most MAXSEG long.
+static int
+runlen(struct buf **bufs, int n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  int i;
 
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
+  for(i = 1; i < n && i < MAXSEG; i++){
+    if(bufs[i]->dev != bufs[0]->dev ||
+       bufs[i]->blockno != bufs[0]->blockno + i)
       break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
   }
+  return i;
+}
 
-  // format the three descriptors.
+// queue one disk operation for the consecutive blocks bufs[0..n)
+// in the ndesc(n) descriptors idx[]. the device may not look at
+// it until virtio_disk_notify().
+// virtio_disk_intr() frees the descriptors when it is done.
+// caller must hold vdisk_lock.
+static void
+virtio_disk_submit(struct buf **bufs, int n, int write, int *idx)
+{
+  uint64 sector = bufs[0]->blockno * (BSIZE / 512);
+  int head = idx[0], seq[MAXSEG+2], i, d;
+  struct virtq_desc *desc = disk.desc;
+
+  if(disk.indirect){
+    // the ring descriptor points to a table that
+    // holds the request's descriptors, in order.
+    desc = disk.tables[head];
+    for(i = 0; i < n+2; i++)
+      seq[i] = i;
+    idx = seq;
+    disk.desc[head].addr = (uint64) desc;
+    disk.desc[head].len = (n+2) * sizeof(struct virtq_desc);
+    disk.desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[head].next = 0;
+  }
+
+  // format the descriptors: the request header, one
+  // for each block's data, and a 1-byte status result.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[head];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -232,51 +274,162 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  desc[idx[0]].addr = (uint64) buf0;
+  desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  desc[idx[0]].next = idx[1];
+
+  for(i = 0; i < n; i++){
+    d = idx[i+1];
+    desc[d].addr = (uint64) bufs[i]->data;
+    desc[d].len = BSIZE;
+    if(write)
+      desc[d].flags = 0; // device reads b->data
+    else
+      desc[d].flags = VRING_DESC_F_WRITE; // device writes b->data
+    desc[d].flags |= VRING_DESC_F_NEXT;
+    desc[d].next = idx[i+2];
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+    // record struct buf for virtio_disk_intr().
+    bufs[i]->disk = 1;
+    disk.info[head].b[i] = bufs[i];
+  }
+  disk.info[head].n = n;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  d = idx[n+1];
+  disk.info[head].status = 0xff; // device writes 0 on success
+  desc[d].addr = (uint64) &disk.info[head].status;
+  desc[d].len = 1;
+  desc[d].flags = VRING_DESC_F_WRITE; // device writes the status
+  desc[d].next = 0;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % disk.num] = head;
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  disk.avail->idx += 1; // not % num ...
+}
 
+// tell the device about the requests virtio_disk_submit()
+// has queued, unless it is already working through the
+// avail ring and has said it will find them.
+// caller must hold vdisk_lock.
+static void
+virtio_disk_notify(void)
+{
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  if((disk.used->flags & VRING_USED_F_NO_NOTIFY) == 0)
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// start reading or writing bufs[0..n), and return without
+// waiting for the operations to finish; virtio_disk_wait()
+// waits for each buffer. each run of consecutive blocks
+// goes to the device as one request.
+void
+virtio_disk_start(struct buf **bufs, int n, int write)
+{
+  int idx[MAXSEG+2], k, queued = 0;
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  acquire(&disk.vdisk_lock);
+  for(; n > 0; bufs += k, n -= k){
+    k = runlen(bufs, n);
+    while(alloc_descs(idx, ndesc(k)) != 0){
+      // let the device start on what is queued.
+      if(queued){
+        virtio_disk_notify();
+        queued = 0;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    virtio_disk_submit(bufs, k, write, idx);
+    queued = 1;
+  }
+  if(queued)
+    virtio_disk_notify();
+  release(&disk.vdisk_lock);
+}
+
+// read or write bufs[0..n), merging runs of consecutive
+// blocks into single requests, and wait for all of them.
+void
+virtio_disk_rw_vec(struct buf **bufs, int n, int write)
+{
+  int i;
+
+  virtio_disk_start(bufs, n, write);
+
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bufs[i]);
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rw_vec(&b, 1, write);
+}
+
+// start reading bufs[0..n) without waiting for the reads to
+// finish, merging runs of consecutive blocks as
+// virtio_disk_start() does. virtio_disk_intr() calls done(b)
+// once each buffer's data has arrived, with vdisk_lock held.
+// stops early, so that an ordinary request need not wait for
+// descriptors, if too many are in use. returns how many of
+// the reads it started.
+int
+virtio_disk_read_async(struct buf **bufs, int n, void (*done)(struct buf *))
+{
+  int i, k, nfree = 0, started, idx[MAXSEG+2];
+
+  acquire(&disk.vdisk_lock);
+  for(i = 0; i < disk.num; i++)
+    nfree += disk.free[i];
+  for(started = 0; started < n; started += k){
+    // leave enough descriptors for a one-block request.
+    k = runlen(bufs + started, n - started);
+    if(!disk.indirect && k > nfree - 5)
+      k = nfree - 5;
+    if(k < 1 || nfree - ndesc(k) < ndesc(1) || alloc_descs(idx, ndesc(k)) != 0)
+      break;
+    nfree -= ndesc(k);
+    for(i = 0; i < k; i++)
+      bufs[started+i]->iodone = done;
+    virtio_disk_submit(bufs + started, k, 0, idx);
+  }
+  if(started > 0)
+    virtio_disk_notify();
+  release(&disk.vdisk_lock);
+  return started;
+}
+
+// wait for an operation on b started by virtio_disk_start()
+// or virtio_disk_read_async(), if one is in flight.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// the device has finished with b.
+// caller must hold vdisk_lock.
+static void
+virtio_disk_done(struct buf *b)
+{
+  void (*done)(struct buf *) = b->iodone;
 
-  release(&disk.vdisk_lock);
+  b->iodone = 0;
+  b->disk = 0;   // disk is done with buf
+  wakeup(b);
+  if(done)
+    done(b);     // no process waits in virtio_disk_rw() for b.
 }
 
 void
@@ -299,14 +452,18 @@ virtio_disk_intr()
 
   while(disk.used_idx != disk.used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = disk.used->ring[disk.used_idx % disk.num].id;
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    // finish each block of the request.
+    for(int i = 0; i < disk.info[id].n; i++){
+      virtio_disk_done(disk.info[id].b[i]);
+      disk.info[id].b[i] = 0;
+    }
+    disk.info[id].n = 0;
+    free_chain(id);
 
     disk.used_idx += 1;
   }
@@ -0,0 +1,92 @@
+// Kernel spin lock benchmark.
+//
+// usage: lockbench [maxharts [iters]]
+//
+// For each lock type, and for 1 up to maxharts processes (one
+// per hart; boot with make CPUS=n), each process acquires and
+// releases the kernel's benchmark lock of that type iters times
+// at once. Reports acquires per millisecond over all processes,
+// and the longest any process waited for the lock.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/spinlock.h"
+#include "user/user.h"
+
+char *names[] = {
+  [SPIN_TAS]    "tas",
+  [SPIN_TICKET] "ticket",
+  [SPIN_MCS]    "mcs",
+};
+
+void
+run(int type, int nproc, int iters)
+{
+  int go[2], res[2];
+  int i, pid;
+  uint64 times[2], elapsed, worst;
+  char c;
+
+  if(pipe(go) < 0 || pipe(res) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(go[1]);
+      read(go[0], &c, 1);
+      if(lockbench(type, iters, times) < 0)
+        times[0] = times[1] = 0;
+      write(res[1], times, sizeof(times));
+      exit(0);
+    }
+  }
+  close(go[0]);
+  close(res[1]);
+
+  // start them all at once.
+  close(go[1]);
+
+  elapsed = worst = 0;
+  for(i = 0; i < nproc; i++){
+    if(read(res[0], times, sizeof(times)) != sizeof(times)){
+      fprintf(2, "lockbench: short read\n");
+      exit(1);
+    }
+    if(times[0] > elapsed)
+      elapsed = times[0];
+    if(times[1] > worst)
+      worst = times[1];
+  }
+  close(res[0]);
+  for(i = 0; i < nproc; i++)
+    wait(0);
+
+  // the time CSR counts at 10 MHz.
+  if(elapsed == 0)
+    elapsed = 1;
+  printf("%s: %d harts: %d acquires/ms, worst wait %d us\n", names[type],
+         nproc, (int)((uint64)nproc * iters * 10000 / elapsed), (int)(worst / 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxharts = 3, iters = 100000;
+  int type, n;
+
+  if(argc > 1)
+    maxharts = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+
+  for(type = SPIN_TAS; type <= SPIN_MCS; type++)
+    for(n = 1; n <= maxharts; n++)
+      run(type, n, iters);
+  exit(0);
+}
@@ -0,0 +1,288 @@
+// Print the kernel lock profile.
+//
+// usage: lockstat [-z] [nlocks]
+//
+// Reads the per-cpu lock profile from the statistics device,
+// merges it, and prints the nlocks locks (by name) with the
+// most total wait time, each with its wait and hold time
+// histograms and its call sites of acquire(), busiest first.
+// Call sites are kernel addresses; look them up with
+//   riscv64-unknown-elf-addr2line -e kernel/kernel <addr>
+// lockstat -z starts a new profile, so that
+//   $ lockstat -z; bcachetest; lockstat
+// profiles just bcachetest.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NHIST 16       // must match NPROFHIST in kernel/spinlock.c
+#define MAXSITE 512
+#define MAXLOCK 128
+#define KERNBASE 0x80000000L
+
+struct prof {
+  char name[16];
+  uint64 pc;           // call site, for a site
+  int n;
+  int wait, hold;      // microseconds
+  int whist[NHIST];
+  int hhist[NHIST];
+};
+
+struct prof sites[MAXSITE];
+int nsite;
+struct prof locks[MAXLOCK];
+int nlock;
+
+char *
+parsenum(char *s, int base, uint64 *v)
+{
+  int d;
+
+  *v = 0;
+  while(*s == ' ')
+    s++;
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      d = *s - '0';
+    else if(base == 16 && *s >= 'a' && *s <= 'f')
+      d = *s - 'a' + 10;
+    else
+      break;
+    *v = *v * base + d;
+  }
+  return s;
+}
+
+void
+add(struct prof *to, struct prof *p)
+{
+  int k;
+
+  to->n += p->n;
+  to->wait += p->wait;
+  to->hold += p->hold;
+  for(k = 0; k < NHIST; k++){
+    to->whist[k] += p->whist[k];
+    to->hhist[k] += p->hhist[k];
+  }
+}
+
+// Parse one line of statsprof() output and merge it into sites.
+void
+parseline(char *s)
+{
+  struct prof p;
+  uint64 v;
+  int i, k;
+
+  memset(&p, 0, sizeof(p));
+  s = parsenum(s, 16, &v);
+  p.pc = KERNBASE + v;
+  s = parsenum(s, 10, &v);
+  p.n = v;
+  s = parsenum(s, 10, &v);
+  p.wait = v;
+  s = parsenum(s, 10, &v);
+  p.hold = v;
+  for(k = 0; k < NHIST; k++){
+    s = parsenum(s, 10, &v);
+    p.whist[k] = v;
+  }
+  for(k = 0; k < NHIST; k++){
+    s = parsenum(s, 10, &v);
+    p.hhist[k] = v;
+  }
+  if(*s == ' ')
+    s++;
+  for(i = 0; s[i] && i < sizeof(p.name)-1; i++)
+    p.name[i] = s[i];
+
+  for(i = 0; i < nsite; i++)
+    if(sites[i].pc == p.pc && strcmp(sites[i].name, p.name) == 0)
+      break;
+  if(i == nsite){
+    if(nsite == MAXSITE)
+      return;
+    sites[nsite].pc = p.pc;
+    strcpy(sites[nsite].name, p.name);
+    nsite++;
+  }
+  add(&sites[i], &p);
+}
+
+void
+readprof(void)
+{
+  char buf[512+1], line[512];
+  int fd, n, i, len;
+
+  fd = open("statistics", O_RDWR);
+  if(fd < 0){
+    fprintf(2, "lockstat: cannot open statistics\n");
+    exit(1);
+  }
+  if(write(fd, "prof", 4) != 4){
+    fprintf(2, "lockstat: kernel has no lock profile\n");
+    exit(1);
+  }
+  len = 0;
+  while((n = read(fd, buf, sizeof(buf)-1)) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] == '\n'){
+        line[len] = 0;
+        parseline(line);
+        len = 0;
+      } else if(len < sizeof(line)-1){
+        line[len++] = buf[i];
+      }
+    }
+  }
+  close(fd);
+}
+
+// Sort by total wait time, then hold time, most first.
+void
+sort(struct prof *a, int n)
+{
+  struct prof t;
+  int i, j;
+
+  for(i = 1; i < n; i++){
+    t = a[i];
+    for(j = i; j > 0 && (a[j-1].wait < t.wait ||
+                         (a[j-1].wait == t.wait && a[j-1].hold < t.hold)); j--)
+      a[j] = a[j-1];
+    a[j] = t;
+  }
+}
+
+// Print s left-justified, or v right-justified, in w columns.
+void
+cols(char *s, int w)
+{
+  int n = strlen(s);
+
+  printf("%s", s);
+  for(; n < w; n++)
+    printf(" ");
+}
+
+void
+colnum(int v, int w)
+{
+  char b[16];
+  int n = 0, i;
+
+  do {
+    b[n++] = '0' + v % 10;
+    v /= 10;
+  } while(v > 0 && n < sizeof(b));
+  for(i = n; i < w; i++)
+    printf(" ");
+  while(n > 0)
+    printf("%c", b[--n]);
+}
+
+// Upper bound of histogram bucket k, in nanoseconds:
+// the time CSR counts at 10 MHz.
+int
+bucketns(int k)
+{
+  return (2 << k) * 100;
+}
+
+// The bucket bound below which a fraction pct/100 of the samples fall.
+int
+percentile(int *hist, int n, int pct)
+{
+  int k, sum = 0;
+
+  for(k = 0; k < NHIST; k++){
+    sum += hist[k];
+    if((uint64)sum * 100 >= (uint64)n * pct)
+      break;
+  }
+  if(k == NHIST)
+    k = NHIST-1;
+  return bucketns(k);
+}
+
+void
+printhist(char *what, int *hist)
+{
+  int k;
+
+  printf("    %s:", what);
+  for(k = 0; k < NHIST; k++)
+    if(hist[k])
+      printf(" <%dns:%d", bucketns(k), hist[k]);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int max = 10;
+  int i, j, fd;
+
+  if(argc > 1 && strcmp(argv[1], "-z") == 0){
+    fd = open("statistics", O_WRONLY);
+    if(fd < 0 || write(fd, "zero", 4) != 4){
+      fprintf(2, "lockstat: cannot reset the lock profile\n");
+      exit(1);
+    }
+    close(fd);
+    exit(0);
+  }
+  if(argc > 1)
+    max = atoi(argv[1]);
+
+  readprof();
+
+  for(i = 0; i < nsite; i++){
+    for(j = 0; j < nlock; j++)
+      if(strcmp(locks[j].name, sites[i].name) == 0)
+        break;
+    if(j == nlock){
+      if(nlock == MAXLOCK)
+        continue;
+      strcpy(locks[nlock++].name, sites[i].name);
+    }
+    add(&locks[j], &sites[i]);
+  }
+  sort(locks, nlock);
+  sort(sites, nsite);
+
+  cols("lock", 16);
+  printf("  acquires   wait us   hold us   wait p50/p99 ns   hold p50/p99 ns\n");
+  for(i = 0; i < nlock && i < max; i++){
+    struct prof *l = &locks[i];
+
+    cols(l->name, 16);
+    colnum(l->n, 10);
+    colnum(l->wait, 10);
+    colnum(l->hold, 10);
+    colnum(percentile(l->whist, l->n, 50), 10);
+    printf("/");
+    colnum(percentile(l->whist, l->n, 99), 7);
+    colnum(percentile(l->hhist, l->n, 50), 11);
+    printf("/");
+    colnum(percentile(l->hhist, l->n, 99), 7);
+    printf("\n");
+    printhist("wait", l->whist);
+    printhist("hold", l->hhist);
+    for(j = 0; j < nsite; j++){
+      if(strcmp(sites[j].name, l->name) != 0)
+        continue;
+      printf("    at %p", sites[j].pc);
+      colnum(sites[j].n, 10);
+      colnum(sites[j].wait, 10);
+      colnum(sites[j].hold, 10);
+      printf("\n");
+    }
+  }
+  exit(0);
+}
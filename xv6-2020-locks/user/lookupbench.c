@@ -0,0 +1,90 @@
+// Contention on read-mostly kernel locks.
+//
+// usage: lookupbench [nproc [iters]]
+//
+// nproc processes each look up the same path (with stat())
+// and read the clock (with uptime()) iters times at once, then
+// reports from the statistics device how often the icache lock
+// and the time lock were acquired, and how many times the cpus
+// spun waiting for them. Lookups of a cached inode take no lock,
+// and reads of ticks should not spin except when a write is in
+// progress.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define SZ 4096
+char buf[SZ];
+
+// Parse the "lock: name: #fetch-and-add N #acquire() M" line
+// for lock name from the statistics device.
+void
+lockstats(char *name, int *nts, int *n)
+{
+  char *p, *q;
+  int len = strlen(name);
+
+  *nts = *n = 0;
+  if(statistics(buf, SZ - 1) <= 0){
+    fprintf(2, "lookupbench: no stats\n");
+    exit(1);
+  }
+  buf[SZ-1] = 0;
+  for(p = buf; (p = strchr(p, ':')) != 0; p++){
+    if(memcmp(p + 2, name, len) != 0 || p[2+len] != ':')
+      continue;
+    if((q = strchr(p, '#')) == 0 || (q = strchr(q, ' ')) == 0)
+      break;
+    *nts = atoi(q + 1);
+    if((q = strchr(q, '#')) == 0 || (q = strchr(q, ' ')) == 0)
+      break;
+    *n = atoi(q + 1);
+    break;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 3, iters = 2000;
+  int inode[2], itime[2], anode[2], atime[2];
+  int i, j, pid;
+  struct stat st;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+
+  lockstats("icache", &inode[0], &anode[0]);
+  lockstats("time", &itime[0], &atime[0]);
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lookupbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < iters; j++){
+        if(stat("/README", &st) < 0){
+          fprintf(2, "lookupbench: stat /README failed\n");
+          exit(1);
+        }
+        uptime();
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  lockstats("icache", &inode[1], &anode[1]);
+  lockstats("time", &itime[1], &atime[1]);
+
+  printf("lookupbench: %d procs x %d lookups\n", nproc, iters);
+  printf("icache: %d acquires, %d spins\n", anode[1] - anode[0],
+         inode[1] - inode[0]);
+  printf("time: %d writes, %d read retries\n", atime[1] - atime[0],
+         itime[1] - itime[0]);
+  exit(0);
+}
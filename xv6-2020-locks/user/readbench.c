@@ -0,0 +1,100 @@
+// Sequential read throughput from a cold buffer cache.
+//
+// usage: readbench [bufsize]
+//
+// Writes a file of MAXFILE blocks, empties the buffer cache by
+// writing "drop" to the statistics device, then reads the file
+// from start to end bufsize bytes at a time (512 by default, as
+// cat does), and reports the throughput, first cold and then
+// with the file cached. With readahead, the cold read keeps
+// several disk requests in flight instead of waiting for each
+// block in turn.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define MAXBUF 8192
+char buf[MAXBUF];
+
+void
+drop(void)
+{
+  int fd;
+
+  fd = open("statistics", O_WRONLY);
+  if(fd < 0 || write(fd, "drop", 4) != 4){
+    fprintf(2, "readbench: cannot drop the buffer cache\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+// Read the whole file; return the time it took, in ticks.
+int
+readall(char *name, int bufsize)
+{
+  int fd, n, tot = 0, t0;
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    fprintf(2, "readbench: open %s failed\n", name);
+    exit(1);
+  }
+  t0 = uptime();
+  while((n = read(fd, buf, bufsize)) > 0)
+    tot += n;
+  t0 = uptime() - t0;
+  close(fd);
+  if(tot != MAXFILE * BSIZE){
+    fprintf(2, "readbench: read %d bytes, expected %d\n", tot, MAXFILE * BSIZE);
+    exit(1);
+  }
+  return t0;
+}
+
+void
+report(char *what, int ticks)
+{
+  if(ticks == 0)
+    ticks = 1;
+  // a tick is about 1/10 second.
+  printf("%s: %d KB in %d ticks, %d KB/s\n",
+         what, MAXFILE * BSIZE / 1024, ticks, MAXFILE * BSIZE / 1024 * 10 / ticks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *name = "readbench.tmp";
+  int bufsize = 512, fd, i;
+
+  if(argc > 1)
+    bufsize = atoi(argv[1]);
+  if(bufsize < 1 || bufsize > MAXBUF){
+    fprintf(2, "readbench: bufsize must be 1..%d\n", MAXBUF);
+    exit(1);
+  }
+
+  unlink(name);
+  if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+    fprintf(2, "readbench: create %s failed\n", name);
+    exit(1);
+  }
+  memset(buf, 'r', BSIZE);
+  for(i = 0; i < MAXFILE; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      fprintf(2, "readbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  drop();
+  report("cold", readall(name, bufsize));
+  report("cached", readall(name, bufsize));
+
+  unlink(name);
+  exit(0);
+}
@@ -0,0 +1,177 @@
+// Buffer cache replacement under a sequential scan.
+//
+// usage: scanbench [nfiles [nbig [rounds]]]
+//
+// Creates a directory of nfiles small files and nbig files of
+// MAXFILE blocks each, then alternates between reading all the
+// big files from start to end and an ls-like pass that reads the
+// directory and stats every small file. For each round it reports
+// how many buffer cache misses the metadata pass took, from the
+// statistics device. With a scan-resistant cache the inode and
+// directory blocks stay cached after the first round or two; with
+// plain LRU every scan flushes them. The scan only pushes blocks
+// out once the cache is full, so use a cache smaller than the
+// scan, e.g.
+//   make clean; make BCACHEFRAC=64 qemu
+//   $ scanbench
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define SZ 4096
+char buf[SZ];
+char data[BSIZE];
+
+// Parse the "bcache: N hits M misses" line
+// from the statistics device.
+int
+misses(void)
+{
+  char *p;
+
+  if(statistics(buf, SZ - 1) <= 0){
+    fprintf(2, "scanbench: no stats\n");
+    exit(1);
+  }
+  buf[SZ-1] = 0;
+  for(p = buf; *p; p++){
+    if(memcmp(p, "bcache: ", 8) == 0 && (p == buf || p[-1] == '\n')){
+      p = strchr(p + 8, ' ');
+      if(p == 0 || (p = strchr(p + 1, ' ')) == 0)
+        break;
+      return atoi(p + 1);
+    }
+  }
+  fprintf(2, "scanbench: no bcache line in stats\n");
+  exit(1);
+}
+
+void
+name(char *s, char c, int i)
+{
+  strcpy(s, "sb/");
+  s[3] = c;
+  s[4] = '0' + i / 100;
+  s[5] = '0' + i / 10 % 10;
+  s[6] = '0' + i % 10;
+  s[7] = 0;
+}
+
+// Read the directory and stat each entry, like ls.
+void
+lspass(void)
+{
+  struct dirent de;
+  struct stat st;
+  char path[4 + DIRSIZ + 1];
+  int fd;
+
+  if((fd = open("sb", O_RDONLY)) < 0){
+    fprintf(2, "scanbench: open sb failed\n");
+    exit(1);
+  }
+  strcpy(path, "sb/");
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0)
+      continue;
+    memmove(path + 3, de.name, DIRSIZ);
+    path[3 + DIRSIZ] = 0;
+    if(stat(path, &st) < 0){
+      fprintf(2, "scanbench: stat %s failed\n", path);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// Read all the big files from start to end.
+void
+scan(int nbig)
+{
+  char path[8];
+  int i, fd;
+
+  for(i = 0; i < nbig; i++){
+    name(path, 'b', i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      fprintf(2, "scanbench: open %s failed\n", path);
+      exit(1);
+    }
+    while(read(fd, data, sizeof(data)) == sizeof(data))
+      ;
+    close(fd);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nfiles = 200, nbig = 16, rounds = 5;
+  char path[8];
+  int i, j, fd, m0, t0;
+
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(argc > 2)
+    nbig = atoi(argv[2]);
+  if(argc > 3)
+    rounds = atoi(argv[3]);
+  if(nfiles > 999 || nbig > 999){
+    fprintf(2, "scanbench: at most 999 files\n");
+    exit(1);
+  }
+
+  if(mkdir("sb") < 0){
+    fprintf(2, "scanbench: mkdir sb failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nfiles; i++){
+    name(path, 'f', i);
+    if((fd = open(path, O_CREATE | O_WRONLY)) < 0){
+      fprintf(2, "scanbench: create %s failed\n", path);
+      exit(1);
+    }
+    write(fd, path, sizeof(path));
+    close(fd);
+  }
+  memset(data, 'x', sizeof(data));
+  for(i = 0; i < nbig; i++){
+    name(path, 'b', i);
+    if((fd = open(path, O_CREATE | O_WRONLY)) < 0){
+      fprintf(2, "scanbench: create %s failed\n", path);
+      exit(1);
+    }
+    for(j = 0; j < MAXFILE; j++){
+      if(write(fd, data, sizeof(data)) != sizeof(data)){
+        fprintf(2, "scanbench: write %s failed\n", path);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  printf("scanbench: %d files, scan of %d blocks\n", nfiles, nbig * MAXFILE);
+  lspass();
+  for(i = 0; i < rounds; i++){
+    scan(nbig);
+    m0 = misses();
+    t0 = uptime();
+    lspass();
+    printf("round %d: ls took %d misses, %d ticks\n",
+           i, misses() - m0, uptime() - t0);
+  }
+
+  for(i = 0; i < nfiles; i++){
+    name(path, 'f', i);
+    unlink(path);
+  }
+  for(i = 0; i < nbig; i++){
+    name(path, 'b', i);
+    unlink(path);
+  }
+  unlink("sb");
+  exit(0);
+}
@@ -0,0 +1,91 @@
+// Concurrent reads of small files in one directory.
+//
+// usage: smallread [nproc [rounds]]
+//
+// Creates NFILE one-block files in the directory sr, then
+// nproc processes each open, read and close every file rounds
+// times at once. All of them look names up in sr and read the
+// same inodes and blocks, so they contend for the sleep locks
+// of sr's inode, of each file's inode and of the buffers;
+// those are held only briefly, by a process that is running.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NFILE 20
+
+char buf[BSIZE];
+
+void
+name(char *s, int i)
+{
+  s[0] = 's';
+  s[1] = 'r';
+  s[2] = '/';
+  s[3] = 'a' + i / 10;
+  s[4] = '0' + i % 10;
+  s[5] = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 3, rounds = 100;
+  char path[6];
+  int i, j, n, fd, pid, t0, t1;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+
+  mkdir("sr");
+  for(i = 0; i < NFILE; i++){
+    name(path, i);
+    if((fd = open(path, O_CREATE | O_WRONLY)) < 0 ||
+       write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "smallread: cannot create %s\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  t0 = uptime();
+  for(n = 0; n < nproc; n++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "smallread: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      for(j = 0; j < rounds; j++){
+        for(i = 0; i < NFILE; i++){
+          name(path, i);
+          if((fd = open(path, O_RDONLY)) < 0 ||
+             read(fd, buf, sizeof(buf)) != sizeof(buf)){
+            fprintf(2, "smallread: cannot read %s\n", path);
+            exit(1);
+          }
+          close(fd);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < n; i++)
+    wait(0);
+  t1 = uptime();
+
+  printf("smallread: %d procs x %d reads: %d ticks\n",
+         n, rounds * NFILE, t1 - t0);
+
+  for(i = 0; i < NFILE; i++){
+    name(path, i);
+    unlink(path);
+  }
+  unlink("sr");
+  exit(0);
+}
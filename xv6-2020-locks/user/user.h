@@ -24,6 +24,9 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int lockbench(int, int, uint64*);
+int sync(void);
+int fsync(int);
 #ifdef LAB_NET
 int connect(uint32, uint16, uint16);
 #endif
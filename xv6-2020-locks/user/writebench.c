@@ -0,0 +1,85 @@
+// Small-file write latency with asynchronous checkpoints.
+//
+// usage: writebench [nfiles]
+//
+// Creates nfiles small files, each with its own write, and
+// reports the time, then how long fsync() takes to install the
+// changes still in the log. Committing a transaction only
+// appends it to the log; the log flusher installs the blocks
+// at their home locations later, in sorted batches, so each
+// create should cost about half the disk writes it used to.
+// Finally checks that the files read back after sync().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+void
+name(char *s, int i)
+{
+  strcpy(s, "wb/");
+  s[3] = 'f';
+  s[4] = '0' + i / 100;
+  s[5] = '0' + i / 10 % 10;
+  s[6] = '0' + i % 10;
+  s[7] = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nfiles = 100;
+  char path[8], buf[8];
+  int i, fd, t0, t1, t2;
+
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(nfiles < 1 || nfiles > 999){
+    fprintf(2, "writebench: nfiles must be 1..999\n");
+    exit(1);
+  }
+
+  if(mkdir("wb") < 0){
+    fprintf(2, "writebench: mkdir wb failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < nfiles; i++){
+    name(path, i);
+    if((fd = open(path, O_CREATE | O_WRONLY)) < 0){
+      fprintf(2, "writebench: create %s failed\n", path);
+      exit(1);
+    }
+    if(write(fd, path, sizeof(path)) != sizeof(path)){
+      fprintf(2, "writebench: write %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  t1 = uptime();
+  if((fd = open("wb", O_RDONLY)) < 0 || fsync(fd) < 0){
+    fprintf(2, "writebench: fsync failed\n");
+    exit(1);
+  }
+  close(fd);
+  t2 = uptime();
+  sync();   // nothing left to install; should return at once.
+  printf("writebench: %d creates in %d ticks, sync %d ticks\n",
+         nfiles, t1 - t0, t2 - t1);
+
+  for(i = 0; i < nfiles; i++){
+    name(path, i);
+    if((fd = open(path, O_RDONLY)) < 0 ||
+       read(fd, buf, sizeof(buf)) != sizeof(buf) ||
+       strcmp(buf, path) != 0){
+      fprintf(2, "writebench: %s reads back wrong\n", path);
+      exit(1);
+    }
+    close(fd);
+    unlink(path);
+  }
+  unlink("wb");
+  printf("writebench: ok\n");
+  exit(0);
+}
@@ -22,6 +22,7 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 struct {
   struct spinlock lock;
@@ -93,11 +94,14 @@ struct buf*
 bread(uint dev, uint blockno)
 {
   struct buf *b;
+  struct proc *p;
 
   b = bget(dev, blockno);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
+    if((p = myproc()) != 0)
+      p->ru.inblock++;
   }
   return b;
 }
@@ -106,9 +110,13 @@ bread(uint dev, uint blockno)
 void
 bwrite(struct buf *b)
 {
+  struct proc *p;
+
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   virtio_disk_rw(b, 1);
+  if((p = myproc()) != 0)
+    p->ru.oublock++;
 }
 
 // Release a locked buffer.
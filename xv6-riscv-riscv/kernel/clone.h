@@ -0,0 +1,3 @@
+// flags for clone()
+#define CLONE_VM     0x100  // share the address space
+#define CLONE_FILES  0x400  // share open files and current directory
@@ -1,11 +1,14 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
+struct mm;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct slab;
 struct stat;
 struct superblock;
 
@@ -33,6 +36,10 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+struct files*   filesalloc(void);
+struct files*   filescopy(struct files*);
+struct files*   filesdup(struct files*);
+void            filesput(struct files*);
 
 // fs.c
 void            fsinit(int);
@@ -81,11 +88,17 @@ void            printfinit(void);
 int             cpuid(void);
 void            kexit(int);
 int             kfork(void);
-int             growproc(int);
-void            proc_mapstacks(pagetable_t);
+int             kclone(uint64, uint64, int, uint64);
+uint64          growproc(int, int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+struct mm*      mmalloc(struct proc *);
+void            mmput(struct mm *, struct proc *);
 int             kkill(int);
+void            leavegroup(void);
+int             ksetnice(int, int);
+int             ksetaffinity(int, uint64);
+int             kgetaffinity(int, uint64*);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -95,7 +108,8 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
-int             kwait(uint64);
+int             kwait(int, uint64, int, uint64);
+int             kgetrusage(int, uint64);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
@@ -119,6 +133,11 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// slab.c
+void            slabinit(struct slab*, char*, uint);
+void*           slaballoc(struct slab*);
+void            slabfree(struct slab*, void*);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -136,11 +155,21 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// futex.c
+void            futexinit(void);
+int             futex(uint64, int, int);
+
+// timer.c
+void            timersinit(void);
+int             sleepuntil(uint64);
+uint64          timerexpire(void);
+
 // trap.c
-extern uint     ticks;
+extern uint64   quantum;
+uint            getticks(void);
+void            settimer(uint64);
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            prepare_return(void);
 
 // uart.c
@@ -154,6 +183,7 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+int             kvmmapstack(uint64, uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
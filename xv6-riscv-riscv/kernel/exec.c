@@ -32,7 +32,8 @@ kexec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
+  pagetable_t pagetable = 0;
+  struct mm *mm = 0, *oldmm;
   struct proc *p = myproc();
 
   begin_op();
@@ -52,8 +53,10 @@ kexec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  // a new, unshared address space.
+  if((mm = mmalloc(p)) == 0)
     goto bad;
+  pagetable = mm->pagetable;
 
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
@@ -79,7 +82,6 @@ kexec(char *path, char **argv)
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
 
   // Allocate some pages at the next page boundary.
   // Make the first inaccessible as a stack guard.
@@ -127,19 +129,24 @@ kexec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
+  // Commit to the user image. Other threads that shared
+  // the old one are killed.
+  leavegroup();
+  oldmm = p->mm;
+  mm->sz = sz;
+  p->mm = mm;
   p->pagetable = pagetable;
-  p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  mmput(oldmm, p);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
+  if(mm){
+    mm->sz = sz;
+    mmput(mm, p);
+  }
   if(ip){
     iunlockput(ip);
     end_op();
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -19,10 +20,15 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// File tables, one per process or group of
+// threads sharing open files.
+static struct slab filesslab;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&filesslab, "files", sizeof(struct files));
 }
 
 // Allocate a file structure.
@@ -178,3 +184,73 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Allocate an empty file table, with no current directory.
+struct files*
+filesalloc(void)
+{
+  struct files *fs;
+
+  if((fs = slaballoc(&filesslab)) == 0)
+    return 0;
+  initlock(&fs->lock, "files");
+  fs->ref = 1;
+  return fs;
+}
+
+// Share file table fs with one more thread.
+struct files*
+filesdup(struct files *fs)
+{
+  acquire(&fs->lock);
+  fs->ref++;
+  release(&fs->lock);
+  return fs;
+}
+
+// Make a copy of file table fs, for fork().
+struct files*
+filescopy(struct files *fs)
+{
+  struct files *nfs;
+  int fd;
+
+  if((nfs = filesalloc()) == 0)
+    return 0;
+  acquire(&fs->lock);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      nfs->ofile[fd] = filedup(fs->ofile[fd]);
+  nfs->cwd = idup(fs->cwd);
+  release(&fs->lock);
+  return nfs;
+}
+
+// Drop a reference to file table fs. The last thread
+// to let go closes the files and the current directory.
+void
+filesput(struct files *fs)
+{
+  int fd;
+
+  acquire(&fs->lock);
+  if(fs->ref > 1){
+    fs->ref--;
+    release(&fs->lock);
+    return;
+  }
+  release(&fs->lock);
+
+  // no one else can use fs now.
+  for(fd = 0; fd < NOFILE; fd++){
+    if(fs->ofile[fd]){
+      fileclose(fs->ofile[fd]);
+      fs->ofile[fd] = 0;
+    }
+  }
+  begin_op();
+  iput(fs->cwd);
+  end_op();
+  fs->cwd = 0;
+  fs->ref = 0;
+  slabfree(&filesslab, fs);
+}
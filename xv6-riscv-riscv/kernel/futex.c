@@ -0,0 +1,156 @@
+// Fast user-space locking: futex(addr, op, val).
+//
+// FUTEX_WAIT puts the calling thread to sleep if the int at
+// user address addr still holds val, and FUTEX_WAKE wakes up
+// to val threads waiting at addr. A user lock needs the kernel
+// only when it is contended: it changes the int with atomic
+// instructions, waits when it finds the lock taken, and wakes a
+// waiter on release only if there may be one.
+//
+// Waiters are hashed by the physical address of addr, not the
+// virtual one, so that any two threads sharing the memory find
+// each other, whatever address they map it at.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "futex.h"
+
+// A thread in FUTEX_WAIT. Lives on the waiter's kernel stack.
+struct futexwaiter {
+  uint64 pa;                  // Physical address waited on
+  struct futexwaiter *next;   // Next waiter in the same queue
+  int woken;
+};
+
+#define NFUTEXQ 64
+struct futexq {
+  struct spinlock lock;
+  struct futexwaiter *head;
+} futexq[NFUTEXQ];
+
+void
+futexinit(void)
+{
+  struct futexq *q;
+
+  for(q = futexq; q < &futexq[NFUTEXQ]; q++)
+    initlock(&q->lock, "futex");
+}
+
+static struct futexq*
+pa2futexq(uint64 pa)
+{
+  return &futexq[(pa * 0x9E3779B97F4A7C15L) >> 58];
+}
+
+// The physical address of user address addr, which must
+// be 4-byte aligned, or 0 if addr is not valid.
+static uint64
+futexpa(uint64 addr)
+{
+  struct proc *p = myproc();
+  uint64 va0, pa0;
+
+  if(addr % 4 != 0)
+    return 0;
+  va0 = PGROUNDDOWN(addr);
+  // allocate a lazily-allocated page, so the
+  // address has a physical page to name it.
+  if((pa0 = walkaddr(p->pagetable, va0)) == 0 &&
+     (pa0 = vmfault(p->pagetable, va0, 1)) == 0)
+    return 0;
+  return pa0 + (addr - va0);
+}
+
+// Sleep until woken by FUTEX_WAKE, if *addr == val.
+// Returns 0 if woken, -1 if *addr != val or if killed.
+static int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct futexwaiter w, **pp;
+  struct futexq *q;
+  int v;
+
+  if((w.pa = futexpa(addr)) == 0)
+    return -1;
+  q = pa2futexq(w.pa);
+
+  // join the queue before looking at *addr. a thread that
+  // changes *addr and then calls FUTEX_WAKE either finds us
+  // on the queue, or changed *addr before we look at it;
+  // futexwake() looks at the queue without q->lock.
+  acquire(&q->lock);
+  w.woken = 0;
+  w.next = q->head;
+  q->head = &w;
+  __sync_synchronize();
+  if(copyin(p->pagetable, (char *)&v, addr, sizeof(v)) < 0 || v != val)
+    goto out;
+  while(!w.woken){
+    if(killed(p))
+      goto out;
+    sleep(&w, &q->lock);
+  }
+  release(&q->lock);
+  return 0;
+
+out:
+  for(pp = &q->head; *pp != &w; pp = &(*pp)->next)
+    ;
+  *pp = w.next;
+  release(&q->lock);
+  return -1;
+}
+
+// Wake up to n threads waiting at addr.
+// Returns the number woken.
+static int
+futexwake(uint64 addr, int n)
+{
+  struct futexwaiter *w, **pp;
+  struct futexq *q;
+  uint64 pa;
+  int woken = 0;
+
+  if((pa = futexpa(addr)) == 0)
+    return -1;
+  q = pa2futexq(pa);
+
+  // the common case: no one to wake. the fence orders the
+  // caller's store to *addr before the look at the queue.
+  __sync_synchronize();
+  if(q->head == 0)
+    return 0;
+
+  acquire(&q->lock);
+  for(pp = &q->head; (w = *pp) != 0 && woken < n; ){
+    if(w->pa == pa){
+      *pp = w->next;
+      w->woken = 1;
+      wakeup(w);
+      woken++;
+    } else {
+      pp = &w->next;
+    }
+  }
+  release(&q->lock);
+  return woken;
+}
+
+int
+futex(uint64 addr, int op, int val)
+{
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
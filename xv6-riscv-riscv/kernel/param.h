@@ -1,4 +1,6 @@
-#define NPROC        64  // maximum number of processes
+#ifndef NPROC
+#define NPROC      1024  // maximum number of processes
+#endif
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -12,4 +14,6 @@
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define TICKTIME     1000000  // time CSR units per clock tick (~1/10 s)
+#define QUANTUM      TICKTIME // default time slice, in time CSR units
 
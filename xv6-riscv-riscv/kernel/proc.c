@@ -4,58 +4,86 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "slab.h"
 #include "defs.h"
+#include "clone.h"
+#include "resource.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Bitmask of the cpus that have entered scheduler().
+static uint64 cpusonline;
+
+#define ALLCPUS ((uint64)-1 >> (64 - NCPU))
+
+static struct slab procslab;
+static struct slab mmslab;
 
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Live processes, hashed by pid, so that finding a process
+// doesn't mean scanning all of them.
+// pid_lock protects the chains, nextpid and nslot.
+// Lock order: p->lock, then pid_lock.
+#define NPIDHASH 256
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+static struct proc *pidhash[NPIDHASH];
+
+// Number of kernel stack and trapframe slots handed out.
+// A struct proc keeps its slot and its kernel stack while
+// it sits free in procslab.
+static int nslot;
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static void ipi(struct cpu *c);
+static void killgroup(int tgid);
 
 extern char trampoline[]; // trampoline.S
 
+// Sleeping processes, hashed by the channel they sleep on,
+// so that wakeup() only looks at processes that might be
+// sleeping on its channel.
+// Lock order: condition lock, then sleepq lock, then p->lock.
+#define NSLEEPQ 64
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+static struct sleepq*
+chan2sleepq(void *chan)
+{
+  // Fibonacci hashing: the top bits of the product
+  // depend on all bits of the address.
+  return &sleepq[((uint64)chan * 0x9E3779B97F4A7C15L) >> 58];
+}
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
-{
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-  }
-}
-
-// initialize the proc table.
+// initialize the process allocator.
 void
 procinit(void)
 {
-  struct proc *p;
+  struct cpu *c;
+  struct sleepq *sq;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rq.lock, "runq");
+  for(sq = sleepq; sq < &sleepq[NSLEEPQ]; sq++)
+    initlock(&sq->lock, "sleepq");
+  slabinit(&procslab, "proc", sizeof(struct proc));
+  slabinit(&mmslab, "mm", sizeof(struct mm));
 }
 
 // Must be called with interrupts disabled,
@@ -102,41 +130,72 @@ allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
+// Set up a struct proc that is new from procslab: allocate
+// a kernel stack page and map it high in memory, followed by
+// an invalid guard page, in the next free slot.
+// Returns 0 on success, -1 if out of memory or slots.
+static int
+procsetup(struct proc *p)
+{
+  char *pa;
+  int slot = -1;
+
+  if((pa = kalloc()) == 0)
+    return -1;
+  acquire(&pid_lock);
+  if(nslot < NPROC && kvmmapstack(KSTACK(nslot), (uint64)pa) == 0)
+    slot = nslot++;
+  release(&pid_lock);
+  if(slot < 0){
+    kfree(pa);
+    return -1;
+  }
+
+  initlock(&p->lock, "proc");
+  p->slot = slot;
+  p->kstack = KSTACK(slot);
+  p->timeridx = -1;
+  return 0;
+}
+
+// Allocate a proc from procslab and give it a pid.
+// Initialize state required to run in the kernel,
 // and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// If out of process slots, or a memory allocation fails, return 0.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  if((p = slaballoc(&procslab)) == 0)
+    return 0;
+  if(p->kstack == 0 && procsetup(p) < 0){
+    slabfree(&procslab, p);
+    return 0;
   }
-  return 0;
 
-found:
+  acquire(&p->lock);
   p->pid = allocpid();
   p->state = USED;
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
+  // make p visible to findproc().
+  acquire(&pid_lock);
+  p->pidnext = pidhash[PIDHASH(p->pid)];
+  pidhash[PIDHASH(p->pid)] = p;
+  release(&pid_lock);
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  p->cpu = -1;
+  p->nice = 0;
+  p->vruntime = 0;
+  p->affinity = ALLCPUS;
+  p->nmigrate = 0;
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
+
+  // Allocate a trapframe page. The caller
+  // maps it into an address space.
+  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
 
@@ -150,25 +209,69 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages, and return it to procslab.
+// p->lock must be held; freeproc() releases it.
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+
+  if(p->mm)
+    mmput(p->mm, p);
+  p->mm = 0;
+  p->pagetable = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[PIDHASH(p->pid)]; *pp != 0; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pid_lock);
+
   p->pid = 0;
+  p->tgid = 0;
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
+  release(&p->lock);
+  slabfree(&procslab, p);
+}
+
+// Return the process with the given pid, with its lock held,
+// or 0 if there is none. p can be freed between the lookup
+// and acquire(&p->lock), but procslab keeps its memory a
+// struct proc, so it is enough to check the pid again under
+// the lock; pids are not reused.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for(p = pidhash[PIDHASH(pid)]; p != 0; p = p->pidnext){
+    if(p->pid == pid)
+      break;
+  }
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -193,9 +296,9 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe page just below the trampoline page, for
+  // map the trapframe page below the trampoline page, for
   // trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  if(mappages(pagetable, TRAPFRAME(p->slot), PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
@@ -207,14 +310,140 @@ proc_pagetable(struct proc *p)
 
 // Free a process's page table, and free the
 // physical memory it refers to.
+// The threads' trapframes must already be unmapped.
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
   uvmfree(pagetable, sz);
 }
 
+// Allocate an address space with no user memory,
+// for use by p. Returns 0 on failure.
+struct mm*
+mmalloc(struct proc *p)
+{
+  struct mm *mm;
+
+  if((mm = slaballoc(&mmslab)) == 0)
+    return 0;
+  initlock(&mm->lock, "mm");
+  if((mm->pagetable = proc_pagetable(p)) == 0){
+    slabfree(&mmslab, mm);
+    return 0;
+  }
+  mm->ref = 1;
+  mm->sz = 0;
+  return mm;
+}
+
+// Add thread p to mm's users, mapping its trapframe.
+// Returns 0 on success, -1 on failure.
+static int
+mmshare(struct mm *mm, struct proc *p)
+{
+  acquire(&mm->lock);
+  if(mappages(mm->pagetable, TRAPFRAME(p->slot), PGSIZE,
+              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+    release(&mm->lock);
+    return -1;
+  }
+  mm->ref++;
+  release(&mm->lock);
+  return 0;
+}
+
+// Thread p is done with mm: unmap its trapframe and drop
+// its reference. The last thread to leave frees the
+// address space. No other hart can still hold mm's
+// mappings in its TLB, since each hart flushes the TLB
+// when it traps into the kernel.
+void
+mmput(struct mm *mm, struct proc *p)
+{
+  acquire(&mm->lock);
+  uvmunmap(mm->pagetable, TRAPFRAME(p->slot), 1, 0);
+  if(--mm->ref > 0){
+    release(&mm->lock);
+    return;
+  }
+  proc_freepagetable(mm->pagetable, mm->sz);
+  mm->pagetable = 0;
+  mm->sz = 0;
+  release(&mm->lock);
+  slabfree(&mmslab, mm);
+}
+
+// Make sure no other hart can still use TLB entries for
+// mappings that the caller has just removed from mm: interrupt
+// the harts that are running mm's threads in user mode, and
+// wait until each has trapped into the kernel, which flushes
+// its TLB (see trampoline.S). A hart that enters user mode
+// after the PTEs were cleared flushes its TLB on the way.
+// Caller must hold mm->lock.
+static void
+tlbshootdown(struct mm *mm)
+{
+  struct cpu *c, *me = mycpu();
+  uint64 ntrap[NCPU];
+  int sent[NCPU];
+
+  // order the PTE stores before the reads of usermm.
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    sent[c - cpus] = 0;
+    if(c != me && c->usermm == mm){
+      ntrap[c - cpus] = c->ntrap;
+      sent[c - cpus] = 1;
+      ipi(c);
+    }
+  }
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(!sent[c - cpus])
+      continue;
+    while(c->usermm == mm && c->ntrap == ntrap[c - cpus])
+      __sync_synchronize();
+  }
+}
+
+// Number of pages to unmap per TLB shootdown.
+#define SHOOTBATCH 32
+
+// Shrink mm from oldsz to newsz bytes while other threads may
+// be using it on other harts: unmap a batch of pages, shoot
+// down stale TLB entries, and only then free the pages.
+// As with uvmdealloc(), newsz need not be less than oldsz,
+// e.g. if sbrk(-n) wrapped around. Returns the new size.
+// Caller must hold mm->lock.
+static uint64
+mmshrink(struct mm *mm, uint64 oldsz, uint64 newsz)
+{
+  uint64 pa[SHOOTBATCH];
+  uint64 va, end;
+  pte_t *pte;
+  int i, n;
+
+  if(newsz >= oldsz)
+    return oldsz;
+
+  va = PGROUNDUP(newsz);
+  end = PGROUNDUP(oldsz);
+  while(va < end){
+    for(n = 0; n < SHOOTBATCH && va < end; va += PGSIZE){
+      if((pte = walk(mm->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;   // lazily-allocated page that was never touched
+      pa[n++] = PTE2PA(*pte);
+      *pte = 0;
+    }
+    if(n == 0)
+      continue;
+    tlbshootdown(mm);
+    for(i = 0; i < n; i++)
+      kfree((void*)pa[i]);
+  }
+  return newsz;
+}
+
 // Set up first user process.
 void
 userinit(void)
@@ -223,103 +452,197 @@ userinit(void)
 
   p = allocproc();
   initproc = p;
-  
-  p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  if((p->mm = mmalloc(p)) == 0 || (p->files = filesalloc()) == 0)
+    panic("userinit");
+  p->pagetable = p->mm->pagetable;
+  p->tgid = p->pid;
+  p->files->cwd = namei("/");
+
+  setrunnable(p);
 
   release(&p->lock);
 }
 
-// Shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
-growproc(int n)
+// Grow or shrink user memory by n bytes; if eager is not
+// set, growing only raises the size (see sys_sbrk()).
+// Return the old size, or -1 on failure.
+uint64
+growproc(int n, int eager)
 {
-  uint64 sz;
-  struct proc *p = myproc();
-
-  sz = p->sz;
-  if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+  uint64 oldsz, sz;
+  struct mm *mm = myproc()->mm;
+
+  acquire(&mm->lock);
+  oldsz = sz = mm->sz;
+  if(n > 0 && !eager){
+    if(sz + n < sz){
+      release(&mm->lock);
+      return -1;
+    }
+    sz += n;
+  } else if(n > 0){
+    if((sz = uvmalloc(mm->pagetable, sz, sz + n, PTE_W)) == 0) {
+      release(&mm->lock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(mm->ref > 1)
+      sz = mmshrink(mm, sz, sz + n);
+    else
+      sz = uvmdealloc(mm->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  mm->sz = sz;
+  release(&mm->lock);
+  return oldsz;
 }
 
-// Create a new process, copying the parent.
-// Sets up child kernel stack to return as if from fork() system call.
-int
-kfork(void)
+// Allocate a new process or thread, sharing the current
+// process's address space and open files if flags
+// (CLONE_VM, CLONE_FILES) say so, and copying them if not.
+// The new proc has the same user registers as the current
+// one. Returns it with its lock held, or 0 on failure.
+static struct proc*
+copyproc(int flags)
 {
-  int i, pid;
+  int r;
   struct proc *np;
   struct proc *p = myproc();
 
   // Allocate process.
   if((np = allocproc()) == 0){
-    return -1;
+    return 0;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
-    release(&np->lock);
-    return -1;
+  if(flags & CLONE_VM){
+    if(mmshare(p->mm, np) < 0)
+      goto bad;
+    np->mm = p->mm;
+    np->tgid = p->tgid;
+  } else {
+    if((np->mm = mmalloc(np)) == 0)
+      goto bad;
+    np->tgid = np->pid;
+
+    // Copy user memory from parent to child.
+    acquire(&p->mm->lock);
+    r = uvmcopy(p->pagetable, np->mm->pagetable, p->mm->sz);
+    if(r == 0)
+      np->mm->sz = p->mm->sz;
+    release(&p->mm->lock);
+    if(r < 0)
+      goto bad;
   }
-  np->sz = p->sz;
+  np->pagetable = np->mm->pagetable;
+
+  // share the open files, or increment reference counts
+  // on them.
+  if(flags & CLONE_FILES)
+    np->files = filesdup(p->files);
+  else if((np->files = filescopy(p->files)) == 0)
+    goto bad;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
-  // Cause fork to return 0 in the child.
-  np->trapframe->a0 = 0;
+  safestrcpy(np->name, p->name, sizeof(p->name));
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  // the child starts with the parent's share of the CPU.
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  np->affinity = p->affinity;
 
-  safestrcpy(np->name, p->name, sizeof(p->name));
+  return np;
+
+bad:
+  freeproc(np);
+  return 0;
+}
+
+// Make np, fresh from copyproc(), a child of the
+// current process and let it run. Returns its pid.
+static int
+startproc(struct proc *np)
+{
+  int pid;
 
   pid = np->pid;
 
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  np->parent = myproc();
+  np->sibling = np->parent->children;
+  np->parent->children = np;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Create a new process, copying the parent.
+// Sets up child kernel stack to return as if from fork() system call.
+int
+kfork(void)
+{
+  struct proc *np;
+
+  if((np = copyproc(0)) == 0)
+    return -1;
+
+  // Cause fork to return 0 in the child.
+  np->trapframe->a0 = 0;
+
+  return startproc(np);
+}
+
+// Create a thread that starts in fn(arg) on the given user
+// stack. It is a child of the caller, so the caller can
+// collect it with wait(). fn must not return; the thread
+// ends by calling exit().
+int
+kclone(uint64 fn, uint64 stack, int flags, uint64 arg)
+{
+  struct proc *np;
+
+  if((flags & ~(CLONE_VM | CLONE_FILES)) != 0 || stack % 16 != 0)
+    return -1;
+  if((np = copyproc(flags)) == 0)
+    return -1;
+
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+
+  return startproc(np);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
-  struct proc *pp;
+  struct proc *pp, *last = 0;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  for(pp = p->children; pp != 0; pp = pp->sibling){
+    pp->parent = initproc;
+    last = pp;
   }
+  if(last == 0)
+    return;
+  last->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
 }
 
-// Exit the current process.  Does not return.
-// An exited process remains in the zombie state
-// until its parent calls wait().
+// Exit the current thread.  Does not return.
+// An exited thread remains in the zombie state
+// until its parent calls wait(). When the first thread
+// of a process exits, the other threads are killed.
 void
 kexit(int status)
 {
@@ -328,19 +651,15 @@ kexit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // if no other thread uses p->mm, there is no one to kill.
+  // the count can't go up meanwhile, since only a thread
+  // using p->mm can clone() another.
+  if(p->tgid == p->pid && p->mm->ref > 1)
+    killgroup(p->tgid);
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+  // Close all open files, unless other threads share them.
+  filesput(p->files);
+  p->files = 0;
 
   acquire(&wait_lock);
 
@@ -362,42 +681,83 @@ kexit(int status)
   panic("zombie exit");
 }
 
+// Add the counts in u to those in sum.
+static void
+addusage(struct usage *sum, struct usage *u)
+{
+  sum->utime += u->utime;
+  sum->stime += u->stime;
+  sum->minflt += u->minflt;
+  sum->inblock += u->inblock;
+  sum->oublock += u->oublock;
+  sum->nvcsw += u->nvcsw;
+  sum->nivcsw += u->nivcsw;
+}
+
+// Copy u out to user address addr as a struct rusage.
+static int
+copyoutusage(uint64 addr, struct usage *u)
+{
+  struct rusage ru;
+
+  // the time CSR counts at 10 MHz.
+  ru.utime = u->utime / 10;
+  ru.stime = u->stime / 10;
+  ru.minflt = u->minflt;
+  ru.majflt = 0;    // nothing is paged in from disk.
+  ru.inblock = u->inblock;
+  ru.oublock = u->oublock;
+  ru.nvcsw = u->nvcsw;
+  ru.nivcsw = u->nivcsw;
+  return copyout(myproc()->pagetable, addr, (char *)&ru, sizeof(ru));
+}
+
 // Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// If pid > 0, wait only for the child with that pid.
+// If options has WNOHANG, return 0 rather than wait.
+// If ru is not 0, copy out the resources used by the child
+// and its waited-for children. Return -1 if this process
+// has no such child.
 int
-kwait(uint64 addr)
+kwait(int pid, uint64 addr, int options, uint64 ru)
 {
-  struct proc *pp;
-  int havekids, pid;
+  struct proc *pp, **ppp;
+  struct usage u;
+  int havekids;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through the children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    for(ppp = &p->children; (pp = *ppp) != 0; ppp = &pp->sibling){
+      if(pid > 0 && pp->pid != pid)
+        continue;
+
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      havekids = 1;
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        u = pp->ru;
+        addusage(&u, &pp->cru);
+        if((addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                 sizeof(pp->xstate)) < 0) ||
+           (ru != 0 && copyoutusage(ru, &u) < 0)) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
-        release(&pp->lock);
+        addusage(&p->cru, &u);
+        *ppp = pp->sibling;
+        freeproc(pp);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -405,26 +765,280 @@ kwait(uint64 addr)
       release(&wait_lock);
       return -1;
     }
+    if(options & WNOHANG){
+      release(&wait_lock);
+      return 0;
+    }
     
     // Wait for a child to exit.
     sleep(p, &wait_lock);  //DOC: wait-sleep
   }
 }
 
+// Copy out the resources used by the current thread
+// (who is RUSAGE_SELF) or by its waited-for children
+// (RUSAGE_CHILDREN) to user address addr.
+int
+kgetrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct usage u;
+
+  if(who == RUSAGE_SELF){
+    u = p->ru;
+    // count the kernel time of this system call so far.
+    u.stime += r_time() - p->tstamp;
+  } else if(who == RUSAGE_CHILDREN){
+    acquire(&wait_lock);
+    u = p->cru;
+    release(&wait_lock);
+  } else {
+    return -1;
+  }
+  return copyoutusage(addr, &u);
+}
+
+// Scheduling weight for each nice value from -20 to 19.
+// Each step is about 1.25x, so that one nice level changes
+// a process's share of a contended CPU by about 10%.
+static const int prio2weight[40] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+   9548,  7620,  6100,  4904,  3906,
+   3121,  2501,  1991,  1586,  1277,
+   1024,   820,   655,   526,   423,
+    335,   272,   215,   172,   137,
+    110,    87,    70,    56,    45,
+     36,    29,    23,    18,    15,
+};
+#define NICE0_WEIGHT 1024
+
+// How far behind the queue's minimum a waking process's vruntime
+// may be, in time CSR units (half a timer tick). Without a limit, a
+// process that slept for a long time would monopolize the CPU.
+#define WAKEUP_CREDIT 500000
+
+// Add p to cpu c's run queue.
+// Caller must hold p->lock.
+static void
+runq_push(struct cpu *c, struct proc *p)
+{
+  struct runq *rq = &c->rq;
+  int i, parent;
+
+  acquire(&rq->lock);
+  if(rq->minvrt > WAKEUP_CREDIT && p->vruntime < rq->minvrt - WAKEUP_CREDIT)
+    p->vruntime = rq->minvrt - WAKEUP_CREDIT;
+
+  // sift up from the new last slot.
+  for(i = rq->n++; i > 0; i = parent){
+    parent = (i - 1) / 2;
+    if(rq->heap[parent]->vruntime <= p->vruntime)
+      break;
+    rq->heap[i] = rq->heap[parent];
+  }
+  rq->heap[i] = p;
+  release(&rq->lock);
+}
+
+// Remove and return the process in slot i of rq's heap.
+// Caller must hold rq->lock.
+static struct proc*
+runq_remove(struct runq *rq, int i)
+{
+  struct proc *p, *last;
+  int parent, child;
+
+  p = rq->heap[i];
+  last = rq->heap[--rq->n];
+  if(i == rq->n)
+    return p;
+
+  // move the former last element into slot i, then sift
+  // it up or down; at most one of the loops does anything.
+  for(; i > 0; i = parent){
+    parent = (i - 1) / 2;
+    if(rq->heap[parent]->vruntime <= last->vruntime)
+      break;
+    rq->heap[i] = rq->heap[parent];
+  }
+  for(; (child = 2*i + 1) < rq->n; i = child){
+    if(child + 1 < rq->n &&
+       rq->heap[child+1]->vruntime < rq->heap[child]->vruntime)
+      child++;
+    if(last->vruntime <= rq->heap[child]->vruntime)
+      break;
+    rq->heap[i] = rq->heap[child];
+  }
+  rq->heap[i] = last;
+  return p;
+}
+
+// Remove and return the process with the smallest vruntime
+// from cpu c's run queue, or 0 if it is empty.
+static struct proc*
+runq_pop(struct cpu *c)
+{
+  struct runq *rq = &c->rq;
+  struct proc *p;
+
+  if(rq->n == 0)
+    return 0;
+
+  acquire(&rq->lock);
+  if(rq->n == 0){
+    release(&rq->lock);
+    return 0;
+  }
+  p = runq_remove(rq, 0);
+  if(p->vruntime > rq->minvrt)
+    rq->minvrt = p->vruntime;
+  release(&rq->lock);
+  return p;
+}
+
+// Remove and return the process with the smallest vruntime
+// on cpu v's run queue that may run on the cpus in mask,
+// or 0 if there is none.
+// p->affinity is read without p->lock; scheduler() checks
+// it again before running p.
+static struct proc*
+runq_popmask(struct cpu *v, uint64 mask)
+{
+  struct runq *rq = &v->rq;
+  struct proc *p = 0;
+  int i, best = -1;
+
+  acquire(&rq->lock);
+  if(rq->n > 0 && (rq->heap[0]->affinity & mask)){
+    best = 0;
+  } else {
+    for(i = 1; i < rq->n; i++){
+      if((rq->heap[i]->affinity & mask) &&
+         (best < 0 || rq->heap[i]->vruntime < rq->heap[best]->vruntime))
+        best = i;
+    }
+  }
+  if(best >= 0)
+    p = runq_remove(rq, best);
+  release(&rq->lock);
+  return p;
+}
+
+// Called by an idle cpu c: take the next process that may run
+// on c from the longest run queue of any other cpu, or from any
+// other queue if the longest holds only processes pinned elsewhere.
+// Returns 0 if there is nothing to steal.
+// The stolen process keeps its vruntime; c's minvrt catches
+// up when the process is picked, so no rebasing is needed.
+static struct proc*
+runq_steal(struct cpu *c)
+{
+  struct cpu *v, *victim = 0;
+  struct proc *p;
+  uint64 bit = 1UL << (c - cpus);
+
+  // The lengths are read without locks; a stale value
+  // only makes the choice of victim less accurate.
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v != c && v->rq.n > 0 && (victim == 0 || v->rq.n > victim->rq.n))
+      victim = v;
+  }
+  if(victim == 0)
+    return 0;
+  if((p = runq_popmask(victim, bit)) != 0)
+    return p;
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v != c && v != victim && v->rq.n > 0 &&
+       (p = runq_popmask(v, bit)) != 0)
+      return p;
+  }
+  return 0;
+}
+
+// Send an inter-processor interrupt to cpu c, to wake it
+// from wfi in scheduler().
+static void
+ipi(struct cpu *c)
+{
+  *(volatile uint32*)CLINT_MSIP(c - cpus) = 1;
+}
+
+// Work that may run on the cpus in mask has been queued on
+// cpu c. If c is idle, wake it up; otherwise wake some other
+// idle cpu in mask, which will steal the work. The swap on
+// idle means only one waker sends each idle cpu an IPI.
+static void
+kick(struct cpu *c, uint64 mask)
+{
+  struct cpu *v;
+
+  __sync_synchronize();
+  if(c->idle && __sync_lock_test_and_set(&c->idle, 0)){
+    ipi(c);
+    return;
+  }
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if((mask & (1UL << (v - cpus))) &&
+       v->idle && __sync_lock_test_and_set(&v->idle, 0)){
+      ipi(v);
+      return;
+    }
+  }
+}
+
+// Choose the run queue for p: the cpu it last ran on, whose
+// caches may still hold its state, if p's affinity allows it;
+// otherwise the current cpu, or else the first cpu p may use.
+// Caller must hold p->lock.
+static struct cpu*
+pickcpu(struct proc *p)
+{
+  uint64 mask = p->affinity & cpusonline;
+  int i, id = cpuid();
+
+  if(p->cpu >= 0 && (mask & (1UL << p->cpu)))
+    return &cpus[p->cpu];
+  if(mask == 0 || (mask & (1UL << id)))
+    return &cpus[id];
+  for(i = 0; (mask & (1UL << i)) == 0; i++)
+    ;
+  return &cpus[i];
+}
+
+// Mark p RUNNABLE and queue it on the cpu chosen by pickcpu().
+// Idle cpus steal work if the queues become unbalanced.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c = pickcpu(p);
+
+  p->state = RUNNABLE;
+  runq_push(c, p);
+  kick(c, p->affinity);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the process with the smallest vruntime from this
+//    cpu's run queue, or steal one from another cpu's queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+//  - charge the time it ran to its vruntime, and requeue
+//    it if it yielded.
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 start, now;
 
   c->proc = 0;
+  __sync_fetch_and_or(&cpusonline, 1UL << id);
   for(;;){
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
@@ -434,28 +1048,69 @@ scheduler(void)
     intr_on();
     intr_off();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
+    if((p = runq_pop(c)) == 0 && (p = runq_steal(c)) == 0){
+      // nothing to run. ask for an IPI when work arrives,
+      // then look once more, since setrunnable() may have
+      // queued work before it could see c->idle. with no
+      // process to preempt, the timer is needed only for
+      // sleep deadlines.
+      c->idle = 1;
+      __sync_synchronize();
+      settimer(~0UL);
+      if((p = runq_pop(c)) == 0 && (p = runq_steal(c)) == 0){
+        // stop running on this core until an interrupt.
+        asm volatile("wfi");
       }
+      c->idle = 0;
+      if(p == 0)
+        continue;
+    }
+
+    // Interrupt it at the end of its time slice. Do this
+    // before taking p->lock: settimer() may wake expired
+    // sleepers, which takes other processes' locks.
+    start = r_time();
+    c->sliceend = start + quantum;
+    settimer(c->sliceend);
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if((p->affinity & (1UL << id)) == 0){
+      // its affinity changed while it was queued here,
+      // or a steal raced with the change.
+      setrunnable(p);
       release(&p->lock);
+      continue;
+    }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    if(p->cpu >= 0 && p->cpu != id){
+      c->nmigrate++;
+      p->nmigrate++;
     }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
-      asm volatile("wfi");
+    p->cpu = id;
+    p->state = RUNNING;
+    p->tstamp = start;
+    c->proc = p;
+    c->nswtch++;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    now = r_time();
+    p->ru.stime += now - p->tstamp;
+    p->vruntime += (now - start) * NICE0_WEIGHT / prio2weight[p->nice + 20];
+    if(p->state == RUNNABLE){
+      if(p->affinity & (1UL << id))
+        runq_push(c, p);
+      else
+        setrunnable(p);
     }
+    release(&p->lock);
   }
 }
 
@@ -493,6 +1148,7 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  p->ru.nivcsw++;
   sched();
   release(&p->lock);
 }
@@ -540,24 +1196,31 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = chan2sleepq(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we are on sq, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup looks at sq, holding sq->lock),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
-  release(lk);
+  acquire(&sq->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->ru.nvcsw++;
+  p->sqnext = sq->head;
+  sq->head = p;
+
+  release(lk);
+  release(&sq->lock);
 
   sched();
 
-  // Tidy up.
+  // Tidy up. wakeup() removed us from sq.
   p->chan = 0;
 
   // Reacquire original lock.
@@ -570,17 +1233,66 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *sq = chan2sleepq(chan);
+  struct proc *p, **pp;
+
+  // Sleepers join sq before releasing the condition
+  // lock, which the caller holds, so an empty sq here
+  // means there is no one to wake.
+  if(sq->head == 0)
+    return;
+
+  acquire(&sq->lock);
+  for(pp = &sq->head; (p = *pp) != 0; ){
+    // p->chan cannot change while p is on sq.
+    if(p->chan == chan){
+      *pp = p->sqnext;
+      acquire(&p->lock);
+      setrunnable(p);
+      release(&p->lock);
+    } else {
+      pp = &p->sqnext;
+    }
+  }
+  release(&sq->lock);
+}
+
+// Wake p if it is still sleeping on chan.
+// Caller must not hold p->lock, which
+// is ordered after the sleep queue's lock.
+static void
+wakeproc(struct proc *p, void *chan)
+{
+  struct sleepq *sq = chan2sleepq(chan);
+  struct proc **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&sq->lock);
+  for(pp = &sq->head; *pp != 0; pp = &(*pp)->sqnext){
+    if(*pp == p){
+      *pp = p->sqnext;
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
+      setrunnable(p);
       release(&p->lock);
+      break;
     }
   }
+  release(&sq->lock);
+}
+
+// Mark p killed, and wake it if it is sleeping.
+// Caller must hold p->lock; killlocked() releases it.
+static void
+killlocked(struct proc *p)
+{
+  void *chan;
+
+  p->killed = 1;
+  chan = p->state == SLEEPING ? p->chan : 0;
+  release(&p->lock);
+  if(chan){
+    // Wake process from sleep().
+    wakeproc(p, chan);
+  }
 }
 
 // Kill the process with the given pid.
@@ -591,20 +1303,113 @@ kkill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  killlocked(p);
+  return 0;
+}
+
+// Kill the threads of group tgid other than the caller.
+// p->lock is ordered before pid_lock, so look for a victim
+// under pid_lock, then lock it and check again. Each pass
+// kills one thread, which later passes skip.
+static void
+killgroup(int tgid)
+{
+  struct proc *p, *me = myproc();
+  int i;
+
+  for(;;){
+    p = 0;
+    acquire(&pid_lock);
+    for(i = 0; i < NPIDHASH && p == 0; i++){
+      for(p = pidhash[i]; p != 0; p = p->pidnext){
+        if(p != me && p->tgid == tgid && !p->killed && p->state != ZOMBIE)
+          break;
       }
-      release(&p->lock);
-      return 0;
+    }
+    release(&pid_lock);
+    if(p == 0)
+      return;
+
+    acquire(&p->lock);
+    if(p->tgid == tgid && !p->killed &&
+       p->state != UNUSED && p->state != ZOMBIE){
+      killlocked(p);
+      continue;
     }
     release(&p->lock);
   }
-  return -1;
+}
+
+// The current thread is exec()ing a new program: make it
+// a process of its own, and kill the other threads of
+// its old process.
+void
+leavegroup(void)
+{
+  struct proc *p = myproc();
+  int tgid;
+
+  acquire(&p->lock);
+  tgid = p->tgid;
+  p->tgid = p->pid;
+  release(&p->lock);
+  if(p->mm->ref > 1)
+    killgroup(tgid);
+}
+
+// Set the nice value of the process with the given pid,
+// which changes its weight in the fair scheduler.
+int
+ksetnice(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < -20 || nice > 19)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->nice = nice;
+  release(&p->lock);
+  return 0;
+}
+
+// Restrict the process with the given pid to the cpus in mask.
+// A queued process moves when a cpu it may use picks it; a
+// running one moves at the end of its time slice, or at once
+// if it is the caller.
+int
+ksetaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  int move;
+
+  mask &= ALLCPUS;
+  if((mask & cpusonline) == 0)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask;
+  move = p == myproc() && (mask & (1UL << cpuid())) == 0;
+  release(&p->lock);
+  if(move)
+    yield();
+  return 0;
+}
+
+// Store the affinity mask of the process with the given pid
+// in *mask.
+int
+kgetaffinity(int pid, uint64 *mask)
+{
+  struct proc *p;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  *mask = p->affinity;
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -671,17 +1476,28 @@ procdump(void)
   [ZOMBIE]    "zombie"
   };
   struct proc *p;
+  struct cpu *c;
   char *state;
+  int i;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
+  for(i = 0; i < NPIDHASH; i++){
+    for(p = pidhash[i]; p != 0; p = p->pidnext){
+      if(p->state == UNUSED)
+        continue;
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      printf("%d %s %s cpu %d migrate %lu", p->pid, state, p->name,
+             p->cpu, p->nmigrate);
+      printf("\n");
+    }
+  }
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->nswtch == 0)
       continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+    printf("cpu %d: runq %d swtch %lu migrate %lu\n",
+           (int)(c - cpus), c->rq.n, c->nswtch, c->nmigrate);
   }
 }
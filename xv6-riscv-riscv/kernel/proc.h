@@ -18,12 +18,31 @@ struct context {
   uint64 s11;
 };
 
+// Per-CPU queue of RUNNABLE processes: a binary min-heap
+// ordered by vruntime, so the process that has received the
+// least weighted CPU time runs next.
+// A RUNNABLE process is on at most one run queue.
+// Lock order: p->lock, then rq.lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *heap[NPROC];   // heap[0] has the smallest vruntime.
+  int n;                      // Number of queued processes.
+  uint64 minvrt;              // Largest vruntime picked so far.
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq rq;             // RUNNABLE processes waiting for this cpu.
+  uint64 nswtch;              // Number of swtch()es to a process.
+  uint64 nmigrate;            // Of those, processes that last ran elsewhere.
+  uint64 sliceend;            // time CSR value when proc's time slice ends.
+  int idle;                   // In wfi; send an IPI when there is work.
+  struct mm *usermm;          // Address space in use in user mode, or null.
+  uint64 ntrap;               // Number of traps from user mode.
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +98,36 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A user address space, shared by the threads of a process.
+// Lock order: p->lock, then mm->lock.
+struct mm {
+  struct spinlock lock;
+  int ref;                     // Number of threads using it
+  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes)
+};
+
+// Open files and current directory, shared by the threads
+// of a process that were created with CLONE_FILES.
+struct files {
+  struct spinlock lock;
+  int ref;                     // Number of threads using it
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
+// Resources used by a thread, as counted by the kernel;
+// getrusage() reports them as a struct rusage.
+struct usage {
+  uint64 utime;                // time CSR units in user mode
+  uint64 stime;                // time CSR units in the kernel
+  uint64 minflt;               // Page faults handled without I/O
+  uint64 inblock;              // Disk blocks read
+  uint64 oublock;              // Disk blocks written
+  uint64 nvcsw;                // Context switches in sleep()
+  uint64 nivcsw;               // Context switches in yield()
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,17 +140,40 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int tgid;                    // Thread group ID: pid of the first thread
+  int cpu;                     // CPU this process last ran on, or -1
+  int nice;                    // -20 (most CPU) to 19 (least CPU)
+  uint64 vruntime;             // CPU time used, scaled by 1/weight
+  uint64 affinity;             // Bitmask of cpus it may run on
+  uint64 nmigrate;             // Times it ran on a different cpu than last time
 
-  // wait_lock must be held when using this:
+  // the sleep queue's lock must be held when using this:
+  struct proc *sqnext;         // Next process on the same sleep queue
+
+  // timers.lock must be held when using these:
+  uint64 deadline;             // time CSR value to wake up at
+  int timeridx;                // Index in timer heap, or -1
+
+  // pid_lock must be held when using this:
+  struct proc *pidnext;        // Next process in the same pid hash chain
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of the same parent
 
   // these are private to the process, so p->lock need not be held.
+  int slot;                    // Index of kernel stack and trapframe addresses
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct mm *mm;               // User memory, maybe shared with threads
+  pagetable_t pagetable;       // User page table, mm->pagetable
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files, maybe shared with threads
   char name[16];               // Process name (debugging)
+  uint64 tstamp;               // time CSR value when it entered or left user mode
+  struct usage ru;             // Resources used by this thread
+
+  // wait_lock must be held when using this:
+  struct usage cru;            // Resources used by waited-for children
 };
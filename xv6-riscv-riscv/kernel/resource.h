@@ -0,0 +1,16 @@
+#define RUSAGE_SELF      0   // the calling thread
+#define RUSAGE_CHILDREN (-1) // its waited-for children and their descendants
+
+#define WNOHANG  1   // wait4(): return 0 if no child has exited yet
+
+// Resources used, for getrusage() and wait4().
+struct rusage {
+  uint64 utime;    // Time in user mode, in microseconds
+  uint64 stime;    // Time in the kernel, in microseconds
+  uint64 minflt;   // Page faults handled without I/O
+  uint64 majflt;   // Page faults that needed I/O
+  uint64 inblock;  // Disk blocks read
+  uint64 oublock;  // Disk blocks written
+  uint64 nvcsw;    // Voluntary context switches
+  uint64 nivcsw;   // Involuntary context switches
+};
@@ -0,0 +1,69 @@
+// Object caches for kernel structures that are allocated and
+// freed often, like struct proc.
+//
+// A slab carves pages from kalloc() into objects of one size.
+// Freed objects go back on the slab's free list, never back to
+// kalloc(), so memory that once held an object of some type
+// always holds an object of that type, and its lock stays
+// valid. Code that reaches an object through a pointer that
+// may be stale can lock it and check that it is still the
+// object it wanted (see findproc() in proc.c).
+//
+// The free-list link is kept in a word after each object, so
+// freeing an object leaves its contents alone. Objects carved
+// from a fresh page are zeroed.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+#define LINK(s, o) (*(void **)((char *)(o) + (s)->size - sizeof(void *)))
+
+void
+slabinit(struct slab *s, char *name, uint size)
+{
+  initlock(&s->lock, name);
+  s->name = name;
+  s->size = (size + 2*sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  if(s->size > PGSIZE)
+    panic("slabinit");
+  s->free = 0;
+  s->nobj = 0;
+}
+
+// Return a free object, or 0 if out of memory.
+void*
+slaballoc(struct slab *s)
+{
+  char *pg, *o;
+
+  acquire(&s->lock);
+  if(s->free == 0){
+    release(&s->lock);
+    if((pg = kalloc()) == 0)
+      return 0;
+    memset(pg, 0, PGSIZE);
+    acquire(&s->lock);
+    for(o = pg; o + s->size <= pg + PGSIZE; o += s->size){
+      LINK(s, o) = s->free;
+      s->free = o;
+      s->nobj++;
+    }
+  }
+  o = s->free;
+  s->free = LINK(s, o);
+  release(&s->lock);
+  return o;
+}
+
+void
+slabfree(struct slab *s, void *o)
+{
+  acquire(&s->lock);
+  LINK(s, o) = s->free;
+  s->free = o;
+  release(&s->lock);
+}
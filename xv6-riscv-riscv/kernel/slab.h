@@ -0,0 +1,8 @@
+// A cache of fixed-size kernel objects.
+struct slab {
+  struct spinlock lock;
+  char *name;        // Name of cache (debugging)
+  uint size;         // Bytes per object, including the free-list link
+  void *free;        // Free objects
+  int nobj;          // Number of objects carved so far
+};
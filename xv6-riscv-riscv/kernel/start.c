@@ -10,6 +10,12 @@ void timerinit();
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// machinevec in kernelvec.S saves two registers here.
+uint64 mscratch0[NCPU][2];
+
+// in kernelvec.S, forwards IPIs to supervisor mode.
+void machinevec();
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -30,7 +36,7 @@ start()
   // delegate all interrupts and exceptions to supervisor mode.
   w_medeleg(0xffff);
   w_mideleg(0xffff);
-  w_sie(r_sie() | SIE_SEIE | SIE_STIE);
+  w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
   // configure Physical Memory Protection to give supervisor mode
   // access to all of physical memory.
@@ -44,6 +50,13 @@ start()
   int id = r_mhartid();
   w_tp(id);
 
+  // machine-mode software interrupts (IPIs sent through the
+  // CLINT) can't be delegated; machinevec turns them into
+  // supervisor software interrupts.
+  w_mscratch((uint64)mscratch0[id]);
+  w_mtvec((uint64)machinevec);
+  w_mie(r_mie() | MIE_MSIE);
+
   // switch to supervisor mode and jump to main().
   asm volatile("mret");
 }
@@ -60,7 +73,10 @@ timerinit()
   
   // allow supervisor to use stimecmp and time.
   w_mcounteren(r_mcounteren() | 2);
+
+  // allow user programs to read time, for benchmarks.
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TICKTIME);
 }
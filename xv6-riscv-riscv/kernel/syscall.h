@@ -20,3 +20,12 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setnice 22
+#define SYS_nanosleep 23
+#define SYS_setquantum 24
+#define SYS_clone  25
+#define SYS_futex  26
+#define SYS_sched_setaffinity 27
+#define SYS_sched_getaffinity 28
+#define SYS_wait4  29
+#define SYS_getrusage 30
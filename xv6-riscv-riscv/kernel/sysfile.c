@@ -18,20 +18,39 @@
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// If other threads share the file table, one of them could close
+// the descriptor at any time, so argfd() takes a reference to
+// the file, which the caller must drop with fileclose().
+// Returns 1 if it did so, 0 if not, or -1 on error.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
-  int fd;
+  int fd, ref = 0;
   struct file *f;
+  struct files *fs = myproc()->files;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  // if fs->ref is 1, it can't go up before this system
+  // call returns, since only this thread could clone().
+  if(fs->ref > 1){
+    acquire(&fs->lock);
+    if((f = fs->ofile[fd]) != 0){
+      filedup(f);
+      ref = 1;
+    }
+    release(&fs->lock);
+  } else {
+    f = fs->ofile[fd];
+  }
+  if(f == 0)
     return -1;
   if(pfd)
     *pfd = fd;
   if(pf)
     *pf = f;
-  return 0;
+  return ref;
 }
 
 // Allocate a file descriptor for the given file.
@@ -40,28 +59,48 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct files *fs = myproc()->files;
 
+  acquire(&fs->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(fs->ofile[fd] == 0){
+      fs->ofile[fd] = f;
+      release(&fs->lock);
       return fd;
     }
   }
+  release(&fs->lock);
   return -1;
 }
 
+// Remove fd from the file table, returning the
+// file it referred to, or 0 if there was none.
+static struct file*
+fdfree(int fd)
+{
+  struct file *f;
+  struct files *fs = myproc()->files;
+
+  acquire(&fs->lock);
+  f = fs->ofile[fd];
+  fs->ofile[fd] = 0;
+  release(&fs->lock);
+  return f;
+}
+
 uint64
 sys_dup(void)
 {
   struct file *f;
-  int fd;
+  int fd, ref;
 
-  if(argfd(0, 0, &f) < 0)
-    return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
   filedup(f);
+  if((fd=fdalloc(f)) < 0)
+    fileclose(f);
+  if(ref)
+    fileclose(f);
   return fd;
 }
 
@@ -69,29 +108,35 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r, ref;
   uint64 p;
 
   argaddr(1, &p);
   argint(2, &n);
-  if(argfd(0, 0, &f) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  if(ref)
+    fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r, ref;
   uint64 p;
   
   argaddr(1, &p);
   argint(2, &n);
-  if(argfd(0, 0, &f) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  if(ref)
+    fileclose(f);
+  return r;
 }
 
 uint64
@@ -100,9 +145,9 @@ sys_close(void)
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  argint(0, &fd);
+  if(fd < 0 || fd >= NOFILE || (f = fdfree(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -113,10 +158,15 @@ sys_fstat(void)
   struct file *f;
   uint64 st; // user pointer to struct stat
 
+  int r, ref;
+
   argaddr(1, &st);
-  if(argfd(0, 0, &f) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  if(ref)
+    fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -341,9 +391,7 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
@@ -360,6 +408,16 @@ sys_open(void)
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
+  // install f only once it is set up, since other threads
+  // sharing the file table can use fd right away.
+  if((fd = fdalloc(f)) < 0){
+    f->type = FD_NONE;  // so that fileclose() leaves ip alone
+    fileclose(f);
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
@@ -410,8 +468,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct files *fs = myproc()->files;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,9 +483,12 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&fs->lock);
+  old = fs->cwd;
+  fs->cwd = ip;
+  release(&fs->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
@@ -488,15 +549,15 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdfree(fd0);
+    fdfree(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
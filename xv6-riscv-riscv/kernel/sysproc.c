@@ -28,60 +28,105 @@ sys_fork(void)
   return kfork();
 }
 
+// create a thread: clone(fn, stack, flags, arg).
+uint64
+sys_clone(void)
+{
+  uint64 fn, stack, arg;
+  int flags;
+
+  argaddr(0, &fn);
+  argaddr(1, &stack);
+  argint(2, &flags);
+  argaddr(3, &arg);
+  return kclone(fn, stack, flags, arg);
+}
+
+// futex(addr, op, val): see futex.c.
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  argaddr(0, &addr);
+  argint(1, &op);
+  argint(2, &val);
+  return futex(addr, op, val);
+}
+
 uint64
 sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
-  return kwait(p);
+  return kwait(-1, p, 0, 0);
+}
+
+uint64
+sys_wait4(void)
+{
+  int pid, options;
+  uint64 status, ru;
+
+  argint(0, &pid);
+  argaddr(1, &status);
+  argint(2, &options);
+  argaddr(3, &ru);
+  return kwait(pid, status, options, ru);
+}
+
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 ru;
+
+  argint(0, &who);
+  argaddr(1, &ru);
+  return kgetrusage(who, ru);
 }
 
 uint64
 sys_sbrk(void)
 {
-  uint64 addr;
   int t;
   int n;
 
   argint(0, &n);
   argint(1, &t);
-  addr = myproc()->sz;
 
-  if(t == SBRK_EAGER || n < 0) {
-    if(growproc(n) < 0) {
-      return -1;
-    }
-  } else {
-    // Lazily allocate memory for this process: increase its memory
-    // size but don't allocate memory. If the processes uses the
-    // memory, vmfault() will allocate it.
-    if(addr + n < addr)
-      return -1;
-    myproc()->sz += n;
-  }
-  return addr;
+  // Unless t is SBRK_EAGER, lazily allocate memory for this
+  // process: increase its memory size but don't allocate
+  // memory. If the processes uses the memory, vmfault() will
+  // allocate it. growproc() returns the old size, which
+  // other threads may be changing concurrently.
+  return growproc(n, t == SBRK_EAGER);
 }
 
 uint64
 sys_pause(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepuntil(r_time() + (uint64)n * TICKTIME);
+}
+
+// sleep for at least the given number of nanoseconds.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns, now, t;
+
+  argaddr(0, &ns);
+  now = r_time();
+  t = ns / (1000000000 / TIMEFREQ);
+  if(t > ~0UL - now)
+    t = ~0UL - now;
+  return sleepuntil(now + t);
 }
 
 uint64
@@ -93,15 +138,64 @@ sys_kill(void)
   return kkill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+uint64
+sys_setnice(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return ksetnice(pid, nice);
+}
+
+uint64
+sys_sched_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  argint(0, &pid);
+  argaddr(1, &mask);
+  return ksetaffinity(pid, mask);
+}
+
+uint64
+sys_sched_getaffinity(void)
+{
+  int pid;
+  uint64 mask, addr;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if(kgetaffinity(pid, &mask) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char *)&mask, sizeof(mask)) < 0)
+    return -1;
+  return 0;
+}
+
+// return how many clock ticks have passed
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return getticks();
+}
+
+// set the scheduling time slice to usec microseconds,
+// unless usec is 0. returns the old time slice, or -1
+// if usec is out of range (100 us to 10 s).
+uint64
+sys_setquantum(void)
+{
+  int usec;
+  uint64 old = quantum / (TIMEFREQ / 1000000);
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  argint(0, &usec);
+  if(usec == 0)
+    return old;
+  if(usec < 100 || usec > 10000000)
+    return -1;
+  quantum = (uint64)usec * (TIMEFREQ / 1000000);
+  return old;
 }
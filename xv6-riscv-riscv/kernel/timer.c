@@ -0,0 +1,131 @@
+// Timed sleep.
+//
+// A process that sleeps for a while records its deadline, in
+// time CSR units, in a min-heap shared by all harts, and sleeps
+// on &p->deadline. settimer() in trap.c programs each hart's
+// stimecmp for the earliest deadline if that comes before the
+// end of the running process's time slice, and the timer
+// interrupt wakes the processes whose deadlines have passed.
+// So only expired sleepers are woken, at sub-tick resolution,
+// instead of every sleeper waking on every tick.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  struct proc *heap[NPROC];  // heap[0] has the earliest deadline.
+  int n;
+} timers;
+
+void
+timersinit(void)
+{
+  initlock(&timers.lock, "timers");
+}
+
+static void
+heapset(int i, struct proc *p)
+{
+  timers.heap[i] = p;
+  p->timeridx = i;
+}
+
+// Move the entry at index i up or down until
+// the heap is ordered again.
+static void
+heapfix(int i)
+{
+  struct proc *p = timers.heap[i];
+  int parent, child;
+
+  for(; i > 0; i = parent){
+    parent = (i - 1) / 2;
+    if(timers.heap[parent]->deadline <= p->deadline)
+      break;
+    heapset(i, timers.heap[parent]);
+  }
+  for(; (child = 2*i + 1) < timers.n; i = child){
+    if(child + 1 < timers.n &&
+       timers.heap[child+1]->deadline < timers.heap[child]->deadline)
+      child++;
+    if(p->deadline <= timers.heap[child]->deadline)
+      break;
+    heapset(i, timers.heap[child]);
+  }
+  heapset(i, p);
+}
+
+// Remove p from the heap.
+// Caller must hold timers.lock.
+static void
+heapremove(struct proc *p)
+{
+  int i = p->timeridx;
+  struct proc *last = timers.heap[--timers.n];
+
+  p->timeridx = -1;
+  if(last != p){
+    heapset(i, last);
+    heapfix(i);
+  }
+}
+
+// Sleep until the time CSR reaches deadline.
+// Returns -1 if the process was killed, 0 otherwise.
+int
+sleepuntil(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  acquire(&timers.lock);
+  while(r_time() < deadline){
+    if(killed(p)){
+      release(&timers.lock);
+      return -1;
+    }
+    p->deadline = deadline;
+    heapset(timers.n++, p);
+    heapfix(p->timeridx);
+
+    // scheduler() calls settimer() before running another
+    // process or going idle, so this hart will wake up in time.
+    sleep(&p->deadline, &timers.lock);
+
+    // kill() wakes a process without taking it off the heap.
+    if(p->timeridx >= 0)
+      heapremove(p);
+  }
+  release(&timers.lock);
+  return 0;
+}
+
+// Wake the processes whose deadlines have passed.
+// Called from settimer() on every hart.
+// Returns the earliest remaining deadline, or ~0 if
+// no process is in a timed sleep.
+uint64
+timerexpire(void)
+{
+  struct proc *p;
+  uint64 now, next = ~0UL;
+
+  if(timers.n == 0)
+    return next;
+
+  acquire(&timers.lock);
+  now = r_time();
+  while(timers.n > 0 && (p = timers.heap[0])->deadline <= now){
+    heapremove(p);
+    wakeup(&p->deadline);
+  }
+  if(timers.n > 0)
+    next = timers.heap[0]->deadline;
+  release(&timers.lock);
+  return next;
+}
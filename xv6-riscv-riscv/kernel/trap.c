@@ -6,8 +6,8 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
-uint ticks;
+uint64 boottime;            // time CSR value at boot
+uint64 quantum = QUANTUM;   // time slice, in time CSR units
 
 extern char trampoline[], uservec[];
 
@@ -19,7 +19,8 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  boottime = r_time();
+  timersinit();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -46,7 +47,18 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // uservec flushed the TLB; tlbshootdown() may be waiting
+  // for this hart to get here.
+  struct cpu *c = mycpu();
+  c->usermm = 0;
+  c->ntrap++;
+
   struct proc *p = myproc();
+
+  // charge the time since prepare_return() to user mode.
+  uint64 now = r_time();
+  p->ru.utime += now - p->tstamp;
+  p->tstamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -80,7 +92,7 @@ usertrap(void)
   if(killed(p))
     kexit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if its time slice is over.
   if(which_dev == 2)
     yield();
 
@@ -117,6 +129,19 @@ prepare_return(void)
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
 
+  // tell uservec where the trapframe is.
+  w_sscratch(TRAPFRAME(p->slot));
+
+  // charge the time since usertrap() or scheduler() to the kernel.
+  uint64 now = r_time();
+  p->ru.stime += now - p->tstamp;
+  p->tstamp = now;
+
+  // from here until the next trap, this hart may cache
+  // p->mm's mappings in its TLB.
+  mycpu()->usermm = p->mm;
+  __sync_synchronize();
+
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
   
@@ -151,7 +176,7 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if its time slice is over.
   if(which_dev == 2 && myproc() != 0)
     yield();
 
@@ -161,26 +186,60 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Number of clock ticks since boot. Derived from the
+// time CSR, which all harts share, so no hart has to
+// take an interrupt just to count ticks.
+uint
+getticks(void)
+{
+  return (r_time() - boottime) / TICKTIME;
+}
+
+// Program this hart's timer. A hart that is running a process
+// needs an interrupt at sliceend, the end of its time slice; an
+// idle hart (sliceend ~0) needs none at all. Either way, wake
+// up for the next sleep deadline, waking expired sleepers now.
+// Interrupts must be disabled.
 void
+settimer(uint64 sliceend)
+{
+  uint64 next;
+
+  next = timerexpire();
+  if(sliceend < next)
+    next = sliceend;
+
+  // this also clears any pending timer interrupt if
+  // next is in the future.
+  w_stimecmp(next);
+}
+
+// Returns 1 if the running process's time slice is over.
+int
 clockintr()
 {
-  if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
-  }
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  int expired = 0;
 
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  if(c->proc == 0){
+    settimer(~0UL);
+    return 0;
+  }
+  if(now >= c->sliceend){
+    // yield() will start a new slice; until then,
+    // don't interrupt again.
+    c->sliceend = now + quantum;
+    expired = 1;
+  }
+  settimer(c->sliceend);
+  return expired;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if timer interrupt and the time slice is over,
+// 1 if other device or timer,
 // 0 if not recognized.
 int
 devintr()
@@ -210,8 +269,13 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000005L){
     // timer interrupt.
-    clockintr();
-    return 2;
+    return clockintr() ? 2 : 1;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt: an IPI from another hart, forwarded
+    // by machinevec. it only needs to wake this hart from wfi,
+    // so that scheduler() looks at the run queues again.
+    w_sip(r_sip() & ~2);
+    return 1;
   } else {
     return 0;
   }
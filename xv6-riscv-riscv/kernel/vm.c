@@ -17,6 +17,8 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static uint64 lazyalloc(struct mm *, uint64, int);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -35,6 +37,9 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
+  // CLINT msip registers, for inter-processor interrupts
+  kvmmap(kpgtbl, CLINT, CLINT, PGSIZE, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -45,9 +50,6 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
   return kpgtbl;
 }
 
@@ -61,6 +63,20 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
     panic("kvmmap");
 }
 
+// Map a process's kernel stack page pa at va, after boot.
+// The kernel page table is shared by all harts; va has never
+// been mapped or touched, so no hart holds a TLB entry for it.
+// Caller must serialize calls.
+// Returns 0 on success, -1 if a page-table page can't be allocated.
+int
+kvmmapstack(uint64 va, uint64 pa)
+{
+  if(mappages(kernel_pagetable, va, PGSIZE, pa, PTE_R | PTE_W) != 0)
+    return -1;
+  sfence_vma();
+  return 0;
+}
+
 // Initialize the kernel_pagetable, shared by all CPUs.
 void
 kvminit(void)
@@ -336,6 +352,28 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// The current thread's address space, locked, if pagetable
+// is its page table; else 0. copyout() and friends hold the
+// lock while they use a page, so that another thread can't
+// unmap and free it meanwhile (see growproc()).
+static struct mm*
+lockmm(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return 0;
+  acquire(&p->mm->lock);
+  return p->mm;
+}
+
+static void
+unlockmm(struct mm *mm)
+{
+  if(mm)
+    release(&mm->lock);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -344,28 +382,34 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
   pte_t *pte;
+  struct mm *mm;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     if(va0 >= MAXVA)
       return -1;
   
+    mm = lockmm(pagetable);
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+      if(mm == 0 || (pa0 = lazyalloc(mm, va0, 1)) == 0) {
+        unlockmm(mm);
         return -1;
       }
     }
 
     pte = walk(pagetable, va0, 0);
     // forbid copyout over read-only user text pages.
-    if((*pte & PTE_W) == 0)
+    if((*pte & PTE_W) == 0){
+      unlockmm(mm);
       return -1;
+    }
       
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    unlockmm(mm);
 
     len -= n;
     src += n;
@@ -381,12 +425,15 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct mm *mm;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
+    mm = lockmm(pagetable);
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+      if(mm == 0 || (pa0 = lazyalloc(mm, va0, 0)) == 0) {
+        unlockmm(mm);
         return -1;
       }
     }
@@ -394,6 +441,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    unlockmm(mm);
 
     len -= n;
     dst += n;
@@ -411,12 +459,16 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  struct mm *mm;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
+    mm = lockmm(pagetable);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0){
+      unlockmm(mm);
       return -1;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -435,6 +487,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    unlockmm(mm);
 
     srcva = va0 + PGSIZE;
   }
@@ -445,30 +498,56 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
-// allocate and map user memory if process is referencing a page
+// allocate and map user memory at va in mm if va is in a page
 // that was lazily allocated in sys_sbrk().
-// returns 0 if va is invalid or already mapped, or if
+// if another thread sharing mm has already mapped the page,
+// returns its physical address, provided it is a user page
+// and, if write is set, writable.
+// returns 0 if va is invalid or the access is not allowed, or if
 // out of physical memory, and physical address if successful.
-uint64
-vmfault(pagetable_t pagetable, uint64 va, int read)
+// caller must hold mm->lock.
+static uint64
+lazyalloc(struct mm *mm, uint64 va, int write)
 {
   uint64 mem;
-  struct proc *p = myproc();
+  pte_t *pte;
 
-  if (va >= p->sz)
+  if (va >= mm->sz)
     return 0;
   va = PGROUNDDOWN(va);
-  if(ismapped(pagetable, va)) {
-    return 0;
+  if(ismapped(mm->pagetable, va)) {
+    pte = walk(mm->pagetable, va, 0);
+    if(write && (*pte & PTE_W) == 0)
+      return 0;
+    return walkaddr(mm->pagetable, va);
   }
   mem = (uint64) kalloc();
   if(mem == 0)
     return 0;
   memset((void *) mem, 0, PGSIZE);
-  if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
+  if (mappages(mm->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
     kfree((void *)mem);
     return 0;
   }
+  myproc()->ru.minflt++;
+  return mem;
+}
+
+// handle a page fault at va by the current process, if it is
+// referencing a page that was lazily allocated in sys_sbrk().
+// another thread may have mapped the page since the fault.
+// returns 0 if va is invalid or the access is not allowed, or if
+// out of physical memory, and physical address if successful.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int read)
+{
+  uint64 mem;
+  struct mm *mm;
+
+  if((mm = lockmm(pagetable)) == 0)
+    return 0;
+  mem = lazyalloc(mm, va, !read);
+  unlockmm(mm);
   return mem;
 }
 
@@ -0,0 +1,141 @@
+// Compare a futex-based barrier with a spinning one.
+//
+// usage: barrierbench [nthreads [rounds]]
+//
+// nthreads clone()d threads pass through a barrier rounds times,
+// first with a barrier in the style of notxv6/barrier.c whose
+// waiters spin, then with barrier_wait() from usync.c, whose
+// waiters sleep in futex(). Each thread checks that no thread
+// gets a round ahead. When there are more threads than harts,
+// e.g.
+//   make CPUS=2 qemu
+//   $ barrierbench 4 200
+// a spinning waiter burns the rest of its time slice while
+// the threads it waits for can't run, so the spin barrier
+// takes about a time slice per round.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/clone.h"
+#include "user/user.h"
+
+#define MAXTHREADS 16
+#define STACKSZ 4096
+
+int nthreads, rounds;
+
+// the spin-only barrier.
+struct {
+  volatile int lock;
+  int arrived;
+  volatile int round;
+} spin;
+
+void
+spinbarrier(void)
+{
+  int round;
+
+  while(__sync_lock_test_and_set(&spin.lock, 1) != 0)
+    ;
+  round = spin.round;
+  if(++spin.arrived == nthreads){
+    spin.arrived = 0;
+    __sync_synchronize();
+    spin.round++;
+    __sync_lock_release(&spin.lock);
+  } else {
+    __sync_lock_release(&spin.lock);
+    while(spin.round == round)
+      ;
+  }
+}
+
+struct barrier bar;
+
+void
+spinworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    if(spin.round != i)
+      exit(1);
+    spinbarrier();
+  }
+  exit(0);
+}
+
+void
+futexworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    if(bar.round != i)
+      exit(1);
+    barrier_wait(&bar);
+  }
+  exit(0);
+}
+
+// run nthreads threads of fn; return the time taken,
+// or -1 if a thread found the barrier broken.
+int
+run(void (*fn)(void*), char *stacks)
+{
+  int i, t0, xst, ok = 1;
+
+  t0 = uptime();
+  for(i = 0; i < nthreads; i++){
+    if(clone(fn, stacks + (i+1)*STACKSZ, CLONE_VM|CLONE_FILES, 0) < 0){
+      fprintf(2, "barrierbench: clone failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < nthreads; i++){
+    wait(&xst);
+    if(xst != 0)
+      ok = 0;
+  }
+  return ok ? uptime() - t0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *stacks;
+  int t;
+
+  nthreads = 2;
+  rounds = 1000;
+  if(argc > 1)
+    nthreads = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(nthreads < 1)
+    nthreads = 1;
+  if(nthreads > MAXTHREADS)
+    nthreads = MAXTHREADS;
+
+  if((stacks = malloc(MAXTHREADS * STACKSZ)) == 0){
+    fprintf(2, "barrierbench: out of memory\n");
+    exit(1);
+  }
+
+  if((t = run(spinworker, stacks)) < 0){
+    fprintf(2, "barrierbench: spin barrier broken\n");
+    exit(1);
+  }
+  printf("barrierbench: spin:  %d threads, %d rounds, %d ticks\n",
+         nthreads, rounds, t);
+
+  barrier_init(&bar, nthreads);
+  if((t = run(futexworker, stacks)) < 0){
+    fprintf(2, "barrierbench: futex barrier broken\n");
+    exit(1);
+  }
+  printf("barrierbench: futex: %d threads, %d rounds, %d ticks\n",
+         nthreads, rounds, t);
+  exit(0);
+}
@@ -0,0 +1,74 @@
+// Measure shell command latency while CPU hogs run.
+//
+// usage: latbench [nhogs [hognice]]
+//
+// Starts nhogs processes that spin forever at nice value
+// hognice, then runs a short command (echo, with its output
+// discarded) the way the shell does -- fork, exec, wait -- and
+// reports the average time per command. Compare
+//   $ latbench 0
+//   $ latbench 8
+//   $ latbench 8 19
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NCMD 20
+#define MAXHOGS 64
+
+int
+main(int argc, char *argv[])
+{
+  int nhogs = 8, hognice = 0;
+  int pids[MAXHOGS];
+  int i, n, pid, t0, t1;
+  char *args[] = { "echo", "hi", 0 };
+
+  if(argc > 1)
+    nhogs = atoi(argv[1]);
+  if(argc > 2)
+    hognice = atoi(argv[2]);
+  if(nhogs > MAXHOGS)
+    nhogs = MAXHOGS;
+
+  for(n = 0; n < nhogs; n++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      setnice(getpid(), hognice);
+      for(;;)
+        ;
+    }
+    pids[n] = pid;
+  }
+
+  // let the hogs build up some CPU time.
+  pause(5);
+
+  t0 = uptime();
+  for(i = 0; i < NCMD; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "latbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      close(1);
+      exec(args[0], args);
+      exit(1);
+    }
+    wait(0);
+  }
+  t1 = uptime();
+
+  for(i = 0; i < n; i++)
+    kill(pids[i]);
+  for(i = 0; i < n; i++)
+    wait(0);
+
+  printf("latbench: %d hogs at nice %d: %d commands in %d ticks\n",
+         n, hognice, NCMD, t1 - t0);
+  exit(0);
+}
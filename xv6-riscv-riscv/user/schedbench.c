@@ -0,0 +1,84 @@
+// Measure the cost of scheduling with many idle processes.
+//
+// usage: schedbench [nidle [rounds]]
+//
+// Forks nidle children that block reading a pipe, then times
+// pipe round trips between two processes; each round trip is
+// two sleep/wakeup pairs and two passes through scheduler().
+// With per-CPU run queues and hashed sleep queues, the time per
+// round trip should not depend on nidle or on the size of the
+// process table, since neither scheduler() nor wakeup() looks
+// at the idle processes. The defaults (60 idle processes) are
+// the pipe round-trip latency benchmark; to scale up, e.g.
+//   make clean; make CPUS=8 qemu
+//   $ schedbench 0
+//   $ schedbench 1000
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int nidle = 60, rounds = 20000;
+  int idle[2], ping[2], pong[2];
+  int i, n, pid, t0, t1;
+  char c;
+
+  if(argc > 1)
+    nidle = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+
+  if(pipe(idle) < 0 || pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "schedbench: pipe failed\n");
+    exit(1);
+  }
+
+  // idle processes: sleep in read() until the write end closes.
+  for(n = 0; n < nidle; n++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(idle[1]);
+      read(idle[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(idle[0]);
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "schedbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        exit(1);
+      write(pong[1], &c, 1);
+    }
+    exit(0);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < rounds; i++){
+    write(ping[1], "x", 1);
+    if(read(pong[0], &c, 1) != 1){
+      fprintf(2, "schedbench: read failed\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  wait(0);
+
+  printf("schedbench: %d idle, %d round trips, %d ticks\n",
+         n, rounds, t1 - t0);
+
+  close(idle[1]);
+  for(i = 0; i < n; i++)
+    wait(0);
+  exit(0);
+}
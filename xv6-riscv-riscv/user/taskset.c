@@ -0,0 +1,85 @@
+// Run a command on a set of cpus, or show or change the cpus
+// a process may run on.
+//
+// usage: taskset mask command [arg ...]
+//        taskset -p pid
+//        taskset -p mask pid
+//
+// mask is a hexadecimal bitmask of cpus, e.g. 1 for cpu 0
+// and 6 for cpus 1 and 2. The affinity is inherited across
+// fork() and exec().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+static void
+usage(void)
+{
+  fprintf(2, "usage: taskset mask command [arg ...]\n"
+             "       taskset -p [mask] pid\n");
+  exit(1);
+}
+
+static uint64
+parsemask(char *s)
+{
+  uint64 mask = 0;
+  int d;
+
+  if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    s += 2;
+  if(*s == 0)
+    usage();
+  for(; *s; s++){
+    if(*s >= '0' && *s <= '9')
+      d = *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      d = *s - 'a' + 10;
+    else if(*s >= 'A' && *s <= 'F')
+      d = *s - 'A' + 10;
+    else
+      usage();
+    mask = mask << 4 | d;
+  }
+  return mask;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 mask;
+  int pid;
+
+  if(argc >= 3 && strcmp(argv[1], "-p") == 0){
+    if(argc == 3){
+      pid = atoi(argv[2]);
+      if(sched_getaffinity(pid, &mask) < 0){
+        fprintf(2, "taskset: no process %d\n", pid);
+        exit(1);
+      }
+      printf("pid %d: affinity mask %lx\n", pid, mask);
+      exit(0);
+    }
+    if(argc != 4)
+      usage();
+    mask = parsemask(argv[2]);
+    pid = atoi(argv[3]);
+    if(sched_setaffinity(pid, mask) < 0){
+      fprintf(2, "taskset: cannot set affinity of %d to %lx\n", pid, mask);
+      exit(1);
+    }
+    exit(0);
+  }
+
+  if(argc < 3)
+    usage();
+  mask = parsemask(argv[1]);
+  if(sched_setaffinity(getpid(), mask) < 0){
+    fprintf(2, "taskset: no cpu in mask %lx\n", mask);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,94 @@
+// Measure how a CPU-bound job scales with kernel threads.
+//
+// usage: threadbench [maxthreads [n]]
+//
+// Counts the primes below n by trial division, split among 1, 2,
+// ... maxthreads clone()d threads that share the counts array,
+// and reports the time for each thread count. With enough harts,
+// e.g.
+//   make CPUS=4 qemu
+//   $ threadbench 4
+// the time should drop almost in proportion to the number of
+// threads, since each thread is scheduled on its own hart.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/clone.h"
+#include "user/user.h"
+
+#define MAXTHREADS 16
+#define STACKSZ 4096
+
+int nthreads, n;
+int counts[MAXTHREADS];
+
+int
+isprime(int x)
+{
+  int d;
+
+  if(x < 2)
+    return 0;
+  for(d = 2; d * d <= x; d++)
+    if(x % d == 0)
+      return 0;
+  return 1;
+}
+
+// thread i checks every nthreads'th number, which balances
+// the load better than contiguous ranges would.
+void
+worker(void *arg)
+{
+  int i = (int)(uint64)arg;
+  int x, c = 0;
+
+  for(x = i; x < n; x += nthreads)
+    c += isprime(x);
+  counts[i] = c;
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxthreads = 4;
+  int i, total, t0, t1;
+  char *stacks;
+
+  n = 2000000;
+  if(argc > 1)
+    maxthreads = atoi(argv[1]);
+  if(argc > 2)
+    n = atoi(argv[2]);
+  if(maxthreads < 1)
+    maxthreads = 1;
+  if(maxthreads > MAXTHREADS)
+    maxthreads = MAXTHREADS;
+
+  if((stacks = malloc(MAXTHREADS * STACKSZ)) == 0){
+    fprintf(2, "threadbench: out of memory\n");
+    exit(1);
+  }
+
+  for(nthreads = 1; nthreads <= maxthreads; nthreads++){
+    t0 = uptime();
+    for(i = 0; i < nthreads; i++){
+      if(clone(worker, stacks + (i+1)*STACKSZ, CLONE_VM|CLONE_FILES,
+               (void*)(uint64)i) < 0){
+        fprintf(2, "threadbench: clone failed\n");
+        exit(1);
+      }
+    }
+    for(i = 0; i < nthreads; i++)
+      wait(0);
+    t1 = uptime();
+
+    total = 0;
+    for(i = 0; i < nthreads; i++)
+      total += counts[i];
+    printf("threadbench: %d threads: %d primes below %d in %d ticks\n",
+           nthreads, total, n, t1 - t0);
+  }
+  exit(0);
+}
@@ -0,0 +1,56 @@
+// Run a command and report the time and other
+// resources it used, on standard error.
+//
+// usage: time command [arg ...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/resource.h"
+#include "user/user.h"
+
+// the time CSR counts at 10 MHz.
+static uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct rusage ru;
+  uint64 t0, t1;
+  int pid, xstatus;
+
+  if(argc < 2){
+    fprintf(2, "usage: time command [arg ...]\n");
+    exit(1);
+  }
+
+  t0 = rdtime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "time: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  if(wait4(pid, &xstatus, 0, &ru) != pid){
+    fprintf(2, "time: wait4 failed\n");
+    exit(1);
+  }
+  t1 = rdtime();
+
+  fprintf(2, "real %lu ms, user %lu ms, sys %lu ms\n",
+          (t1 - t0) / 10000, ru.utime / 1000, ru.stime / 1000);
+  fprintf(2, "%lu minor + %lu major faults, %lu blocks in, %lu blocks out\n",
+          ru.minflt, ru.majflt, ru.inblock, ru.oublock);
+  fprintf(2, "%lu voluntary + %lu involuntary context switches\n",
+          ru.nvcsw, ru.nivcsw);
+  exit(xstatus);
+}
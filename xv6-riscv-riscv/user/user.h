@@ -1,6 +1,7 @@
 #define SBRK_ERROR ((char *)-1)
 
 struct stat;
+struct rusage;
 
 // system calls
 int fork(void);
@@ -24,6 +25,15 @@ int getpid(void);
 char* sys_sbrk(int,int);
 int pause(int);
 int uptime(void);
+int setnice(int, int);
+int nanosleep(uint64);
+int setquantum(int);
+int clone(void (*)(void*), void*, int, void*);
+int futex(volatile int*, int, int);
+int sched_setaffinity(int, uint64);
+int sched_getaffinity(int, uint64*);
+int wait4(int, int*, int, struct rusage*);
+int getrusage(int, struct rusage*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -47,3 +57,27 @@ void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
 // umalloc.c
 void* malloc(uint);
 void free(void*);
+
+// usync.c
+struct mutex {
+  volatile int state;
+};
+struct cond {
+  volatile int seq;
+};
+struct barrier {
+  struct mutex lock;
+  struct cond cond;
+  int n;          // number of threads
+  int arrived;    // threads waiting in this round
+  volatile int round;
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void barrier_init(struct barrier*, int);
+void barrier_wait(struct barrier*);
@@ -4,6 +4,9 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/clone.h"
+#include "kernel/futex.h"
+#include "kernel/resource.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -874,6 +877,455 @@ preempt(char *s)
   wait(0);
 }
 
+// setnice() accepts only nice values from -20 to 19,
+// and only for existing processes.
+void
+nicetest(char *s)
+{
+  int pid;
+
+  if(setnice(getpid(), -21) != -1 || setnice(getpid(), 20) != -1){
+    printf("%s: setnice accepted an out-of-range value\n", s);
+    exit(1);
+  }
+  if(setnice(getpid(), 5) != 0 || setnice(getpid(), 0) != 0){
+    printf("%s: setnice failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(0);
+  if(setnice(pid, 1) != -1){
+    printf("%s: setnice succeeded on a dead process\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() sleeps for at least as long as asked, and
+// many concurrent sleepers each wake up at their own deadline.
+void
+nanosleeptest(char *s)
+{
+  int i, pid, t0, t1, xst;
+
+  if(nanosleep(0) != 0){
+    printf("%s: nanosleep(0) failed\n", s);
+    exit(1);
+  }
+
+  t0 = uptime();
+  nanosleep(300000000);  // 0.3 seconds, or three ticks
+  t1 = uptime();
+  if(t1 - t0 < 2){
+    printf("%s: woke up after %d ticks\n", s, t1 - t0);
+    exit(1);
+  }
+
+  for(i = 0; i < 20; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      t0 = uptime();
+      nanosleep((i % 4 + 1) * 100000000UL);
+      exit(uptime() - t0 < i % 4 ? 1 : 0);
+    }
+  }
+  for(i = 0; i < 20; i++){
+    wait(&xst);
+    if(xst != 0){
+      printf("%s: a sleeper woke up early\n", s);
+      exit(1);
+    }
+  }
+}
+
+// setquantum() changes the time slice within limits, and
+// CPU-bound processes still get preempted with a short one.
+void
+quantumtest(char *s)
+{
+  int old;
+
+  old = setquantum(0);
+  if(old < 100){
+    printf("%s: bad time slice %d\n", s, old);
+    exit(1);
+  }
+  if(setquantum(50) != -1){
+    printf("%s: setquantum accepted 50 us\n", s);
+    exit(1);
+  }
+  if(setquantum(5000) != old || setquantum(0) != 5000){
+    printf("%s: setquantum did not take effect\n", s);
+    exit(1);
+  }
+  preempt(s);
+  setquantum(old);
+}
+
+#define NCLONE 4
+volatile int clonevals[NCLONE];
+int clonefd;
+
+void
+clonethread(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  clonevals[i] = i + 1;
+  if(i == 0)
+    clonefd = open("clonefile", O_CREATE|O_RDWR);
+  exit(i);
+}
+
+// clone()d threads share memory and open files with the
+// thread that created them, which wait()s for them to exit.
+void
+clonetest(char *s)
+{
+  char *stack;
+  int i, pid, xst, seen = 0;
+
+  if((stack = malloc(NCLONE * PGSIZE)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  if(clone(clonethread, stack + PGSIZE, 0x1, 0) != -1){
+    printf("%s: clone accepted bad flags\n", s);
+    exit(1);
+  }
+  clonefd = -1;
+  for(i = 0; i < NCLONE; i++){
+    if(clone(clonethread, stack + (i+1)*PGSIZE, CLONE_VM|CLONE_FILES,
+             (void*)(uint64)i) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++){
+    pid = wait(&xst);
+    if(pid < 0 || xst < 0 || xst >= NCLONE || (seen & (1 << xst))){
+      printf("%s: bad wait for thread\n", s);
+      exit(1);
+    }
+    seen |= 1 << xst;
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(clonevals[i] != i + 1){
+      printf("%s: thread %d's store not seen\n", s, i);
+      exit(1);
+    }
+  }
+  if(clonefd < 0 || write(clonefd, "x", 1) != 1){
+    printf("%s: thread's open file not shared\n", s);
+    exit(1);
+  }
+  close(clonefd);
+  unlink("clonefile");
+  free(stack);
+}
+
+volatile char *shrinkpage;
+volatile int shrinkstarted;
+
+void
+shrinkthread(void *arg)
+{
+  for(;;){
+    shrinkpage[0]++;
+    shrinkstarted = 1;
+  }
+}
+
+// after sbrk() unmaps memory, a thread running on another
+// CPU must fault on it, rather than keep using a stale TLB
+// entry for a freed page.
+void
+cloneshrink(char *s)
+{
+  char *stack;
+  int xst;
+
+  stack = malloc(PGSIZE);
+  shrinkpage = sbrk(2*PGSIZE);
+  if(stack == 0 || shrinkpage == SBRK_ERROR){
+    printf("%s: out of memory\n", s);
+    exit(1);
+  }
+  shrinkpage += PGSIZE;
+  shrinkstarted = 0;
+  if(clone(shrinkthread, stack + PGSIZE, CLONE_VM|CLONE_FILES, 0) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  while(shrinkstarted == 0)
+    ;
+  sbrk(-PGSIZE);
+  if(wait(&xst) < 0 || xst != -1){
+    printf("%s: thread survived sbrk(-n)\n", s);
+    exit(1);
+  }
+}
+
+void
+spinthread(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// when the first thread of a process exits,
+// the other threads die too.
+void
+cloneexit(char *s)
+{
+  char *stack;
+  int fds[2], pid;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // the thread shares the pipe's write end, so the
+    // read below sees EOF only once it has exited.
+    close(fds[0]);
+    stack = malloc(PGSIZE);
+    if(clone(spinthread, stack + PGSIZE, CLONE_VM|CLONE_FILES, 0) < 0)
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 0){
+    printf("%s: read from pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  wait(0);
+}
+
+// sbrk(-n) below zero in a process with threads must leave its
+// size alone, as it does without threads; a fault far above
+// the heap must then kill the process, not panic the kernel.
+void
+cloneshrinkwrap(char *s)
+{
+  char *stack, *sz;
+  int pid, xst;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    stack = malloc(PGSIZE);
+    if(stack == 0 || clone(spinthread, stack + PGSIZE, CLONE_VM|CLONE_FILES, 0) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+    sz = sbrk(0);
+    sbrk(-((int)(uint64)sz + PGSIZE));
+    if(sbrk(0) != sz){
+      printf("%s: sbrk(-n) below zero changed the size\n", s);
+      exit(1);
+    }
+    *(volatile char *)(~0UL - PGSIZE) = 1;
+    exit(0);
+  }
+  if(wait(&xst) != pid || xst != -1){
+    printf("%s: fault above MAXVA not killed\n", s);
+    exit(1);
+  }
+}
+
+struct mutex futexmu;
+int futexcount;
+volatile int futexword;
+
+void
+futexthread(void *arg)
+{
+  int i;
+
+  if(arg){
+    // wait until the main thread changes futexword.
+    while(futexword == 0)
+      futex(&futexword, FUTEX_WAIT, 0);
+    exit(0);
+  }
+  for(i = 0; i < 10000; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+  exit(0);
+}
+
+// futex() sleeps only if the word holds the expected value,
+// FUTEX_WAKE wakes a sleeper, and a futex-based mutex keeps
+// threads' increments from being lost.
+void
+futextest(char *s)
+{
+  char *stack;
+  int i;
+
+  futexword = 1;
+  if(futex(&futexword, FUTEX_WAIT, 0) != -1){
+    printf("%s: FUTEX_WAIT slept on a changed value\n", s);
+    exit(1);
+  }
+  if(futex(&futexword, FUTEX_WAKE, 1) != 0){
+    printf("%s: FUTEX_WAKE woke someone\n", s);
+    exit(1);
+  }
+
+  if((stack = malloc(4 * PGSIZE)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  futexword = 0;
+  if(clone(futexthread, stack + PGSIZE, CLONE_VM|CLONE_FILES, (void*)1) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  pause(2);
+  futexword = 1;
+  futex(&futexword, FUTEX_WAKE, 1);
+  wait(0);
+
+  mutex_init(&futexmu);
+  futexcount = 0;
+  for(i = 0; i < 3; i++){
+    if(clone(futexthread, stack + (i+2)*PGSIZE, CLONE_VM|CLONE_FILES, 0) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 3; i++)
+    wait(0);
+  if(futexcount != 30000){
+    printf("%s: mutex lost increments: %d\n", s, futexcount);
+    exit(1);
+  }
+  free(stack);
+}
+
+// an affinity mask must name a cpu, is inherited by fork(),
+// and a process pinned to one cpu still runs.
+void
+affinitytest(char *s)
+{
+  uint64 mask;
+  int i, pid, xst;
+
+  if(sched_setaffinity(getpid(), 0) != -1){
+    printf("%s: empty affinity mask accepted\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(getpid(), 1) != 0 ||
+     sched_getaffinity(getpid(), &mask) != 0 || mask != 1){
+    printf("%s: could not pin to cpu 0\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(sched_getaffinity(getpid(), &mask) != 0 || mask != 1)
+      exit(1);
+    for(i = 0; i < 10; i++)
+      pause(1);
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: child did not inherit affinity\n", s);
+    exit(1);
+  }
+  if(sched_getaffinity(pid, &mask) != -1){
+    printf("%s: sched_getaffinity succeeded on a dead process\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(getpid(), ~0UL) != 0){
+    printf("%s: could not unpin\n", s);
+    exit(1);
+  }
+}
+
+// getrusage() and wait4() report a child's CPU time,
+// page faults and context switches.
+void
+rusagetest(char *s)
+{
+  struct rusage ru, cru;
+  char *a;
+  int i, pid, t0, xst;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // touch some lazily-allocated pages, sleep, then spin.
+    a = sbrklazy(10 * PGSIZE);
+    if(a == SBRK_ERROR)
+      exit(1);
+    for(i = 0; i < 10; i++)
+      a[i * PGSIZE] = 1;
+    pause(1);
+    t0 = uptime();
+    while(uptime() < t0 + 2)
+      ;
+    if(getrusage(RUSAGE_SELF, &ru) != 0 || ru.minflt < 10 ||
+       ru.utime == 0 || ru.nvcsw == 0)
+      exit(1);
+    exit(0);
+  }
+
+  if(wait4(pid, &xst, WNOHANG, &ru) != 0){
+    printf("%s: WNOHANG returned a running child\n", s);
+    exit(1);
+  }
+  if(wait4(getpid(), &xst, 0, &ru) != -1){
+    printf("%s: wait4 for a non-child succeeded\n", s);
+    exit(1);
+  }
+  if(wait4(pid, &xst, 0, &ru) != pid || xst != 0){
+    printf("%s: child's own getrusage() was wrong\n", s);
+    exit(1);
+  }
+  if(ru.utime == 0 || ru.minflt < 10 || ru.nvcsw == 0){
+    printf("%s: wait4 rusage: utime %lu minflt %lu nvcsw %lu\n",
+           s, ru.utime, ru.minflt, ru.nvcsw);
+    exit(1);
+  }
+  if(getrusage(RUSAGE_CHILDREN, &cru) != 0 || cru.utime < ru.utime){
+    printf("%s: RUSAGE_CHILDREN missed the child\n", s);
+    exit(1);
+  }
+}
+
 // try to find any races between exit and wait
 void
 exitwait(char *s)
@@ -1962,7 +2414,7 @@ iref(char *s)
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = 2000 };  // more than NPROC
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1979,7 +2431,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2723,6 +3175,16 @@ struct test {
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
+  {nicetest, "nicetest"},
+  {nanosleeptest, "nanosleep"},
+  {quantumtest, "quantum"},
+  {clonetest, "clone"},
+  {cloneshrink, "cloneshrink"},
+  {cloneexit, "cloneexit"},
+  {cloneshrinkwrap, "cloneshrinkwrap"},
+  {futextest, "futex"},
+  {affinitytest, "affinity"},
+  {rusagetest, "rusage"},
   {exitwait, "exitwait"},
   {reparent, "reparent" },
   {twochildren, "twochildren"},
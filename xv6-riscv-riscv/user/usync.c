@@ -0,0 +1,106 @@
+// Mutexes, condition variables and barriers for threads
+// that share memory (see clone()), built on futex().
+// Uncontended operations stay in user space; a thread
+// calls into the kernel only to sleep or to wake a sleeper.
+
+#include "kernel/types.h"
+#include "kernel/futex.h"
+#include "user/user.h"
+
+// m->state is 0 if m is unlocked, 1 if locked, and 2 if
+// locked and some thread may be sleeping on it.
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // announce a waiter, in case the holder is about
+  // to release m, then sleep until it is free.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex(&m->state, FUTEX_WAIT, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    // there may be waiters.
+    __sync_lock_release(&m->state);
+    futex(&m->state, FUTEX_WAKE, 1);
+  }
+}
+
+// c->seq changes on every signal, so that a thread that
+// is about to sleep in cond_wait() notices one that came
+// after it released the mutex.
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex(&c->seq, FUTEX_WAIT, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, 0x7fffffff);
+}
+
+// b->round counts the times all n threads have arrived.
+void
+barrier_init(struct barrier *b, int n)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->cond);
+  b->n = n;
+  b->arrived = 0;
+  b->round = 0;
+}
+
+// Wait until all b->n threads have called barrier_wait().
+void
+barrier_wait(struct barrier *b)
+{
+  int round;
+
+  mutex_lock(&b->lock);
+  round = b->round;
+  if(++b->arrived == b->n){
+    b->arrived = 0;
+    b->round++;
+    cond_broadcast(&b->cond);
+  } else {
+    while(b->round == round)
+      cond_wait(&b->cond, &b->lock);
+  }
+  mutex_unlock(&b->lock);
+}
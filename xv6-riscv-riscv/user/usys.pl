@@ -42,3 +42,12 @@ entry("getpid");
 entry("sbrk");
 entry("pause");
 entry("uptime");
+entry("setnice");
+entry("nanosleep");
+entry("setquantum");
+entry("clone");
+entry("futex");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("wait4");
+entry("getrusage");
@@ -0,0 +1,74 @@
+// Measure wake-up-to-run latency.
+//
+// usage: wakelat [rounds]
+//
+// A child blocks reading a pipe. The parent sleeps briefly, so
+// that every hart can go idle, then writes the current time CSR
+// value to the pipe. The child reads it as soon as it is running
+// again and reports the difference. Without IPIs, a woken process
+// queued on an idle hart waits in wfi until that hart's next timer
+// tick, which is tens of milliseconds on average.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define ROUNDS 50
+
+// the time CSR counts at 10 MHz.
+static uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = ROUNDS;
+  int fds[2];
+  int i, pid;
+  uint64 t0, dt, min, max, sum;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds < 1)
+    rounds = 1;
+  if(pipe(fds) < 0){
+    fprintf(2, "wakelat: pipe failed\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "wakelat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    min = ~0UL;
+    max = sum = 0;
+    for(i = 0; i < rounds; i++){
+      if(read(fds[0], &t0, sizeof(t0)) != sizeof(t0))
+        exit(1);
+      dt = rdtime() - t0;
+      if(dt < min)
+        min = dt;
+      if(dt > max)
+        max = dt;
+      sum += dt;
+    }
+    printf("wakelat: %d wakeups: min %lu us, avg %lu us, max %lu us\n",
+           rounds, min / 10, sum / rounds / 10, max / 10);
+    exit(0);
+  }
+
+  for(i = 0; i < rounds; i++){
+    nanosleep(20000000);  // 20 ms: long enough for the harts to idle.
+    t0 = rdtime();
+    write(fds[1], &t0, sizeof(t0));
+  }
+  wait(0);
+  exit(0);
+}